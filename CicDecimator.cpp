@@ -0,0 +1,82 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "CicDecimator.h"
+
+CicDecimator::CicDecimator() : m_factor(1), m_shift(0) {
+    reset();
+}
+
+bool CicDecimator::isValidFactor(int factor) {
+    return factor >= 1 && factor <= CIC_MAX_FACTOR && (factor & (factor-1)) == 0;
+}
+
+bool CicDecimator::setFactor(int factor) {
+    int bits = 0;
+
+    if (!isValidFactor(factor))
+        return false;
+    while ((1 << bits) < factor)
+        bits++;
+
+    m_factor = factor;
+    m_shift = CIC_ORDER * bits;
+    reset();
+    return true;
+}
+
+void CicDecimator::reset() {
+    for (int s=0; s<CIC_ORDER; s++) {
+        for (int a=0; a<3; a++) {
+            m_integrator[s][a] = 0;
+            m_comb[s][a] = 0;
+        }
+    }
+    m_phase = 0;
+}
+
+bool CicDecimator::push(const int16_t* in, int16_t* out) {
+    if (m_factor == 1) {
+        out[0] = in[0];
+        out[1] = in[1];
+        out[2] = in[2];
+        return true;
+    }
+
+    for (int a=0; a<3; a++) {
+        uint32_t v = (uint32_t)(int32_t)in[a];
+        for (int s=0; s<CIC_ORDER; s++) {
+            m_integrator[s][a] += v;
+            v = m_integrator[s][a];
+        }
+    }
+    if (++m_phase < m_factor)
+        return false;
+    m_phase = 0;
+
+    for (int a=0; a<3; a++) {
+        uint32_t v = m_integrator[CIC_ORDER-1][a];
+        for (int s=0; s<CIC_ORDER; s++) {
+            uint32_t d = v - m_comb[s][a];
+            m_comb[s][a] = v;
+            v = d;
+        }
+        // Round to nearest while removing the gain
+        out[a] = (int16_t)(((int32_t)v + (1 << (m_shift-1))) >> m_shift);
+    }
+    return true;
+}
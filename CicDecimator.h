@@ -0,0 +1,60 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef CIC_DECIMATOR_H
+#define CIC_DECIMATOR_H
+
+#include <stdint.h>
+
+#define CIC_ORDER 3
+#define CIC_MAX_FACTOR 32  // 14-bit input plus CIC_ORDER*5 bits of gain still fits 32 bits
+
+// Fixed-point CIC decimator for x,y,z samples.
+//
+// A third order cascaded integrator-comb filter low-pass filters and
+// decimates by factor using only adds and one shift per output, which
+// suits the Cortex-M0+. The factor is a power of two, so the filter gain
+// factor^CIC_ORDER is removed by a shift. The integrators may wrap, the
+// combs undo it as long as the output fits in 32 bits. The output lags
+// the newest input by CIC_ORDER*(factor-1)/2 input samples, and the
+// first CIC_ORDER outputs after a reset are still settling.
+class CicDecimator {
+public:
+    CicDecimator();
+
+    // Decimate by factor, a power of two up to CIC_MAX_FACTOR; 1 passes
+    // samples straight through. Returns false and changes nothing for
+    // any other factor. Resets the filter.
+    bool setFactor(int factor);
+    static bool isValidFactor(int factor);
+    int factor() const { return m_factor; }
+
+    void reset();
+
+    // Feed one input sample. Returns true with an output sample in out
+    // on every factor-th input; out may be the same memory as in.
+    bool push(const int16_t* in, int16_t* out);
+
+private:
+    uint32_t m_integrator[CIC_ORDER][3];
+    uint32_t m_comb[CIC_ORDER][3];  // Previous input of each comb stage
+    int m_factor;
+    int m_shift;
+    int m_phase;
+};
+
+#endif
@@ -0,0 +1,220 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "CommandParser.h"
+
+#define NUMBER_LIMIT 100000000  // Saturate rather than overflow
+
+static inline bool isSpace(uint8_t c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static inline bool isDigit(uint8_t c) {
+    return c >= '0' && c <= '9';
+}
+
+CommandParser::CommandParser() {
+    reset();
+}
+
+void CommandParser::reset() {
+    m_state = WAIT_OBJECT;
+}
+
+void CommandParser::startNumber(uint8_t c) {
+    m_number = 0;
+    m_negative = (c == '-');
+    m_digits = false;
+    if (isDigit(c)) {
+        m_number = c - '0';
+        m_digits = true;
+    }
+}
+
+void CommandParser::endNumber() {
+    int32_t value = m_negative ? -m_number : m_number;
+
+    if (m_target == TARGET_ID) {
+        m_cmd.hasId = true;
+        m_cmd.id = value;
+        return;
+    }
+    // The values of keys other than the command and its id are skipped
+    if (m_target != TARGET_COMMAND)
+        return;
+
+    if (m_cmd.type == CMD_VALUE_ARRAY) {
+        if (m_cmd.valueCount < CMD_MAX_VALUES)
+            m_cmd.values[m_cmd.valueCount++] = value;
+    } else {
+        m_cmd.type = CMD_VALUE_INT;
+        m_cmd.values[0] = value;
+        m_cmd.valueCount = 1;
+    }
+}
+
+PARSE_RESULT CommandParser::error(uint8_t c) {
+    m_state = (c == '}') ? WAIT_OBJECT : SKIP_OBJECT;
+    return PARSE_ERROR;
+}
+
+PARSE_RESULT CommandParser::feed(uint8_t c) {
+    switch (m_state) {
+        case WAIT_OBJECT:
+            if (c == '{') {
+                m_cmd.name[0] = 0;
+                m_cmd.key = 0;
+                m_cmd.type = CMD_VALUE_NONE;
+                m_cmd.valueCount = 0;
+                m_cmd.str[0] = 0;
+                m_cmd.hasId = false;
+                m_cmd.id = 0;
+                m_haveCommand = false;
+                m_state = WAIT_KEY;
+            }
+            return PARSE_MORE;
+
+        case WAIT_KEY:
+            if (isSpace(c))
+                return PARSE_MORE;
+            if (c == '\'' || c == '"') {
+                m_quote = c;
+                m_keyLen = 0;
+                m_idKey = true;
+                m_state = KEY;
+                return PARSE_MORE;
+            }
+            return error(c);
+
+        case KEY:
+            if (c == m_quote) {
+                if (m_idKey && m_keyLen == 2) {
+                    m_target = TARGET_ID;
+                    if (!m_haveCommand) {
+                        m_cmd.name[0] = 0;  // 'id' came first, the command follows
+                        m_cmd.key = 0;
+                    }
+                } else if (!m_haveCommand) {
+                    if (m_keyLen > CMD_NAME_LENGTH)
+                        m_keyLen = CMD_NAME_LENGTH;
+                    m_cmd.key <<= 8 * (CMD_NAME_LENGTH - m_keyLen);  // pad short names
+                    m_haveCommand = true;
+                    m_target = TARGET_COMMAND;
+                } else {
+                    m_target = TARGET_SKIP;
+                }
+                m_state = WAIT_COLON;
+            } else {
+                m_idKey = m_idKey && m_keyLen < 2 && c == "id"[m_keyLen];
+                if (!m_haveCommand && m_keyLen < CMD_NAME_LENGTH) {
+                    m_cmd.name[m_keyLen] = c;
+                    m_cmd.name[m_keyLen+1] = 0;
+                    m_cmd.key = (m_cmd.key << 8) | c;
+                }
+                if (m_keyLen <= CMD_NAME_LENGTH)
+                    m_keyLen++;
+            }
+            return PARSE_MORE;
+
+        case WAIT_COLON:
+            if (isSpace(c))
+                return PARSE_MORE;
+            if (c == ':') {
+                m_state = WAIT_VALUE;
+                return PARSE_MORE;
+            }
+            return error(c);
+
+        case WAIT_VALUE:
+            if (isSpace(c))
+                return PARSE_MORE;
+            if (c == '\'' || c == '"') {
+                m_quote = c;
+                m_keyLen = 0;
+                if (m_target == TARGET_COMMAND)
+                    m_cmd.type = CMD_VALUE_STRING;
+                m_state = STRING;
+            } else if (c == '[') {
+                if (m_target == TARGET_COMMAND)
+                    m_cmd.type = CMD_VALUE_ARRAY;
+                m_state = ARRAY;
+            } else if (c == '-' || isDigit(c)) {
+                startNumber(c);
+                m_state = NUMBER;
+            } else {
+                return error(c);
+            }
+            return PARSE_MORE;
+
+        case NUMBER:
+        case ARRAY_NUMBER:
+            if (isDigit(c)) {
+                if (m_number < NUMBER_LIMIT)
+                    m_number = m_number * 10 + (c - '0');
+                m_digits = true;
+                return PARSE_MORE;
+            }
+            if (!m_digits)
+                return error(c);
+            endNumber();
+            m_state = (m_state == NUMBER) ? AFTER_VALUE : ARRAY;
+            if (m_state == ARRAY && c == ',')
+                return PARSE_MORE;
+            return feed(c);
+
+        case STRING:
+            if (c == m_quote) {
+                m_state = AFTER_VALUE;
+            } else if (m_target == TARGET_COMMAND && m_keyLen < CMD_MAX_STRING) {
+                m_cmd.str[m_keyLen++] = c;
+                m_cmd.str[m_keyLen] = 0;
+            }
+            return PARSE_MORE;
+
+        case ARRAY:
+            if (isSpace(c) || c == ',')
+                return PARSE_MORE;
+            if (c == ']') {
+                m_state = AFTER_VALUE;
+            } else if (c == '-' || isDigit(c)) {
+                startNumber(c);
+                m_state = ARRAY_NUMBER;
+            } else {
+                return error(c);
+            }
+            return PARSE_MORE;
+
+        case AFTER_VALUE:
+            if (isSpace(c))
+                return PARSE_MORE;
+            if (c == ',') {
+                m_state = WAIT_KEY;
+                return PARSE_MORE;
+            }
+            if (c == '}') {
+                m_state = WAIT_OBJECT;
+                return PARSE_COMMAND;
+            }
+            return error(c);
+
+        case SKIP_OBJECT:
+            if (c == '}')
+                m_state = WAIT_OBJECT;
+            return PARSE_MORE;
+    }
+    return PARSE_MORE;
+}
@@ -0,0 +1,111 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef COMMAND_PARSER_H
+#define COMMAND_PARSER_H
+
+#include <stdint.h>
+
+#define CMD_NAME_LENGTH 6
+#define CMD_MAX_VALUES 4
+#define CMD_MAX_STRING 8
+
+enum CMD_VALUE_TYPE
+{
+    CMD_VALUE_NONE,
+    CMD_VALUE_INT,
+    CMD_VALUE_STRING,
+    CMD_VALUE_ARRAY,
+};
+
+// One parsed {'NAME':value} command, optionally with a request id as in
+// {'NAME':value,'id':n}. Names longer than CMD_NAME_LENGTH, strings longer
+// than CMD_MAX_STRING and arrays with more than CMD_MAX_VALUES entries
+// are truncated.
+struct Command {
+    char name[CMD_NAME_LENGTH+1];
+    uint64_t key;             // name packed as in CommandTable.h
+    CMD_VALUE_TYPE type;
+    int32_t values[CMD_MAX_VALUES];
+    int valueCount;
+    char str[CMD_MAX_STRING+1];
+    bool hasId;
+    int32_t id;               // Integer 'id' key, echoed in the Ack
+};
+
+enum PARSE_RESULT
+{
+    PARSE_MORE,     // Need more input
+    PARSE_COMMAND,  // command() holds a complete command
+    PARSE_ERROR,    // Malformed input, skipped up to the next '}'
+};
+
+// Incremental parser for the JSON-ish command protocol, e.g.
+// {'SETRGB':[255,0,0]} or {"GETINF":1}.
+//
+// Input is fed one byte at a time and all state is kept in the parser,
+// so commands may be split across USB packets and several commands may
+// share a packet. Nothing is buffered besides the command being built.
+class CommandParser {
+public:
+    CommandParser();
+
+    PARSE_RESULT feed(uint8_t c);
+    const Command* command() const { return &m_cmd; }
+    void reset();
+
+private:
+    // What the value being read belongs to
+    enum TARGET
+    {
+        TARGET_COMMAND,  // The first key that is not 'id'
+        TARGET_ID,
+        TARGET_SKIP,     // Any other key
+    };
+
+    enum STATE
+    {
+        WAIT_OBJECT,
+        WAIT_KEY,
+        KEY,
+        WAIT_COLON,
+        WAIT_VALUE,
+        NUMBER,
+        STRING,
+        ARRAY,
+        ARRAY_NUMBER,
+        AFTER_VALUE,
+        SKIP_OBJECT,
+    };
+
+    void startNumber(uint8_t c);
+    void endNumber();
+    PARSE_RESULT error(uint8_t c);
+
+    STATE m_state;
+    TARGET m_target;
+    Command m_cmd;
+    uint8_t m_quote;
+    bool m_haveCommand;
+    bool m_idKey;
+    int m_keyLen;
+    int32_t m_number;
+    bool m_negative;
+    bool m_digits;
+};
+
+#endif
@@ -0,0 +1,101 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef COMMAND_TABLE_H
+#define COMMAND_TABLE_H
+
+#include <stdint.h>
+#include "CommandParser.h"
+
+// Command names are packed into 48-bit keys, first character in the most
+// significant byte, so numeric key order equals alphabetical name order.
+// The parser builds the same key while it reads the name.
+#define CMD_KEY(a,b,c,d,e,f) \
+    (((uint64_t)(a) << 40) | ((uint64_t)(b) << 32) | ((uint64_t)(c) << 24) | \
+     ((uint64_t)(d) << 16) | ((uint64_t)(e) << 8) | (uint64_t)(f))
+
+// Key and name of a table entry from the same six characters
+#define COMMAND(a,b,c,d,e,f) CMD_KEY(a,b,c,d,e,f), {a,b,c,d,e,f,0}
+
+// Argument schema, a mask of the accepted value types
+#define CMD_ARG_NONE    (1 << CMD_VALUE_NONE)
+#define CMD_ARG_INT     (1 << CMD_VALUE_INT)
+#define CMD_ARG_STRING  (1 << CMD_VALUE_STRING)
+#define CMD_ARG_ARRAY   (1 << CMD_VALUE_ARRAY)
+#define CMD_ARG_ANY     (CMD_ARG_NONE | CMD_ARG_INT | CMD_ARG_STRING | CMD_ARG_ARRAY)
+
+#define COMMAND_COUNT(table) (sizeof(table) / sizeof(table[0]))
+
+// Outcome of a command, reported in the Ack of commands sent with an id
+enum CMD_STATUS
+{
+    CMD_OK,
+    CMD_INVALID,  // Bad value, nothing changed
+    CMD_BUSY,     // Refused while logging or downloading
+    CMD_UNKNOWN,  // No such command
+};
+
+inline const char* commandStatusName(CMD_STATUS status) {
+    static const char* const names[] = { "ok", "invalid", "busy", "unknown" };
+    return names[status];
+}
+
+struct CommandEntry {
+    uint64_t key;
+    char name[CMD_NAME_LENGTH+1];
+    uint8_t args;
+    void (*handler)(const Command* cmd);
+    const char* help;
+};
+
+// Strictly ascending keys, so findCommand() finds every entry and no
+// two names share their first six characters
+inline bool commandTableSorted(const CommandEntry* table, int count) {
+    for (int i=1; i<count; i++) {
+        if (table[i-1].key >= table[i].key)
+            return false;
+    }
+    return true;
+}
+
+// Binary search, tables must be sorted by name
+inline const CommandEntry* findCommand(const CommandEntry* table, int count, uint64_t key) {
+    int lo = 0;
+    int hi = count - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) >> 1;
+        if (table[mid].key == key)
+            return &table[mid];
+        if (table[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return 0;
+}
+
+inline bool commandAccepts(const CommandEntry* entry, const Command* cmd) {
+    return (entry->args & (1 << cmd->type)) != 0;
+}
+
+// First value of a command, 0 if it has none
+inline int32_t commandValue(const Command* cmd) {
+    return cmd->valueCount ? cmd->values[0] : 0;
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef CYCLE_COUNTER_H
+#define CYCLE_COUNTER_H
+
+#include "mbed.h"
+
+// Core clock cycle counter.
+//
+// The Cortex-M0+ has no DWT cycle counter, but SysTick is left unused by
+// mbed 2 on the KL25Z/KL46Z (the us ticker runs on the PIT), so it can
+// free-run as a 24-bit down counter clocked by the core. That covers
+// about 350 ms at 48 MHz; longer intervals wrap.
+#define CYCLE_COUNTER_MASK 0x00FFFFFF
+
+inline void cycleCounterStart() {
+    SysTick->LOAD = CYCLE_COUNTER_MASK;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+inline uint32_t cycleCount() {
+    return SysTick->VAL;
+}
+
+// Cycles elapsed since a cycleCount() reading
+inline uint32_t cyclesSince(uint32_t start) {
+    return (start - SysTick->VAL) & CYCLE_COUNTER_MASK;
+}
+
+#endif
@@ -0,0 +1,157 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "DeltaLog.h"
+
+// A delta of two int16 values needs 17 bits once zigzag encoded
+#define MAX_DELTA_BITS 17
+#define MAX_BLOCK_BITS (3 * (DELTA_LOG_WIDTH_BITS + DELTA_LOG_BLOCK * MAX_DELTA_BITS))
+
+static inline uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline int bitWidth(uint32_t v) {
+    int bits = 0;
+    while (v) {
+        bits++;
+        v >>= 1;
+    }
+    return bits;
+}
+
+DeltaLog::DeltaLog() {
+    begin(0, 0);
+}
+
+void DeltaLog::begin(uint8_t* buf, uint32_t size) {
+    m_buf = buf;
+    m_size = size;
+    m_bitPos = 0;
+    m_samples = 0;
+    m_prev[0] = m_prev[1] = m_prev[2] = 0;
+    m_pendingCount = 0;
+    rewind();
+}
+
+bool DeltaLog::append(const int16_t* xyz) {
+    // Only start a block if even a worst case one fits
+    if (m_pendingCount == 0 && m_bitPos + MAX_BLOCK_BITS > m_size * 8)
+        return false;
+
+    for (int axis = 0; axis < 3; axis++) {
+        m_pending[axis][m_pendingCount] = zigzag((int32_t)xyz[axis] - m_prev[axis]);
+        m_prev[axis] = xyz[axis];
+    }
+    m_samples++;
+    if (++m_pendingCount == DELTA_LOG_BLOCK)
+        writeBlock();
+    return true;
+}
+
+void DeltaLog::finish() {
+    if (m_pendingCount)
+        writeBlock();
+}
+
+void DeltaLog::writeBlock() {
+    for (int axis = 0; axis < 3; axis++) {
+        uint32_t all = 0;
+        for (int i = 0; i < m_pendingCount; i++)
+            all |= m_pending[axis][i];
+
+        int width = bitWidth(all);
+        writeBits(width, DELTA_LOG_WIDTH_BITS);
+        for (int i = 0; i < m_pendingCount; i++)
+            writeBits(m_pending[axis][i], width);
+    }
+    m_pendingCount = 0;
+}
+
+void DeltaLog::writeBits(uint32_t value, int bits) {
+    while (bits > 0) {
+        uint32_t byte = m_bitPos >> 3;
+        int shift = m_bitPos & 7;
+        int n = 8 - shift;
+        if (n > bits)
+            n = bits;
+
+        uint8_t mask = ((1 << n) - 1) << shift;
+        m_buf[byte] = (m_buf[byte] & ~mask) | ((value << shift) & mask);
+        value >>= n;
+        bits -= n;
+        m_bitPos += n;
+    }
+}
+
+void DeltaLog::rewind() {
+    m_readBitPos = 0;
+    m_readSamples = 0;
+    m_readPrev[0] = m_readPrev[1] = m_readPrev[2] = 0;
+    m_blockLen = 0;
+    m_blockPos = 0;
+}
+
+bool DeltaLog::next(int16_t* xyz) {
+    if (m_blockPos == m_blockLen) {
+        if (m_readSamples == m_samples)
+            return false;
+        readBlock();
+    }
+    xyz[0] = m_block[m_blockPos][0];
+    xyz[1] = m_block[m_blockPos][1];
+    xyz[2] = m_block[m_blockPos][2];
+    m_blockPos++;
+    return true;
+}
+
+void DeltaLog::readBlock() {
+    uint32_t left = m_samples - m_readSamples;
+    m_blockLen = left < DELTA_LOG_BLOCK ? left : DELTA_LOG_BLOCK;
+    m_blockPos = 0;
+
+    for (int axis = 0; axis < 3; axis++) {
+        int width = readBits(DELTA_LOG_WIDTH_BITS);
+        for (int i = 0; i < m_blockLen; i++) {
+            m_readPrev[axis] += unzigzag(readBits(width));
+            m_block[i][axis] = m_readPrev[axis];
+        }
+    }
+    m_readSamples += m_blockLen;
+}
+
+uint32_t DeltaLog::readBits(int bits) {
+    uint32_t value = 0;
+    int got = 0;
+
+    while (got < bits) {
+        uint32_t byte = m_readBitPos >> 3;
+        int shift = m_readBitPos & 7;
+        int n = 8 - shift;
+        if (n > bits - got)
+            n = bits - got;
+
+        value |= (uint32_t)((m_buf[byte] >> shift) & ((1 << n) - 1)) << got;
+        got += n;
+        m_readBitPos += n;
+    }
+    return value;
+}
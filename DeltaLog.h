@@ -0,0 +1,79 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef DELTA_LOG_H
+#define DELTA_LOG_H
+
+#include <stdint.h>
+
+#define DELTA_LOG_BLOCK 8   // Samples per bit-packed block
+#define DELTA_LOG_WIDTH_BITS 5
+
+// Compressed x,y,z sample store.
+//
+// Each axis is stored as zigzag-encoded deltas to the previous sample.
+// Samples are grouped in blocks of DELTA_LOG_BLOCK; for every block and
+// axis a 5-bit width is written followed by the deltas packed at that
+// width. Slowly moving accelerometer data typically needs 2-4 bits per
+// axis instead of 16.
+//
+// Samples are encoded as they arrive; finish() writes the last, partial
+// block. Reading back is a sequential stream from rewind().
+class DeltaLog {
+public:
+    DeltaLog();
+
+    // Start a new, empty log in buf
+    void begin(uint8_t* buf, uint32_t size);
+
+    // Add one x,y,z sample. Returns false when the log is full.
+    bool append(const int16_t* xyz);
+
+    // Flush the pending partial block, call when recording ends
+    void finish();
+
+    uint32_t samples() const { return m_samples; }
+    uint32_t bytesUsed() const { return (m_bitPos + 7) >> 3; }
+
+    // Sequential read back of a finished log
+    void rewind();
+    bool next(int16_t* xyz);
+
+private:
+    void writeBits(uint32_t value, int bits);
+    uint32_t readBits(int bits);
+    void writeBlock();
+    void readBlock();
+
+    uint8_t* m_buf;
+    uint32_t m_size;
+    uint32_t m_bitPos;
+    uint32_t m_samples;
+    int16_t m_prev[3];
+    uint32_t m_pending[3][DELTA_LOG_BLOCK];
+    int m_pendingCount;
+
+    // Reader state
+    uint32_t m_readBitPos;
+    uint32_t m_readSamples;
+    int16_t m_readPrev[3];
+    int16_t m_block[DELTA_LOG_BLOCK][3];
+    int m_blockLen;
+    int m_blockPos;
+};
+
+#endif
@@ -0,0 +1,73 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef INT_TEXT_H
+#define INT_TEXT_H
+
+#include <stdint.h>
+
+// Divide-free integer to decimal text.
+//
+// The Cortex-M0+ has no divide instruction, so every / and % by 10 is a
+// library call. uintToText() counts each digit out by subtracting powers
+// of ten instead, at most nine compare-and-subtract steps per digit.
+// intToText() adds printf style padding, with the width and the pad
+// character fixed at compile time. Neither writes a terminator.
+
+// Decimal digits of v into buf (10 bytes is enough), returns the count
+inline int uintToText(uint32_t v, char* buf) {
+    static const uint32_t powers[] = {
+        1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10
+    };
+    int n = 0;
+
+    for (unsigned int i=0; i<sizeof(powers)/sizeof(powers[0]); i++) {
+        char digit = '0';
+        while (v >= powers[i]) {
+            v -= powers[i];
+            digit++;
+        }
+        if (n || digit != '0')
+            buf[n++] = digit;
+    }
+    buf[n++] = '0' + v;
+    return n;
+}
+
+// Like printf "%<Width>d", or "%0<Width>d" when Pad is '0'. Writes at
+// least Width characters (11 without padding is enough), returns the count.
+template<int Width, char Pad>
+int intToText(int32_t v, char* buf) {
+    char digits[10];
+    uint32_t u = (v < 0) ? -(uint32_t)v : (uint32_t)v;
+    int n = uintToText(u, digits);
+    int len = n + (v < 0);
+    int i = 0;
+
+    // Zeros go after the sign, spaces before it
+    if (v < 0 && Pad == '0')
+        buf[i++] = '-';
+    for (; len < Width; len++)
+        buf[i++] = Pad;
+    if (v < 0 && Pad != '0')
+        buf[i++] = '-';
+    for (int j=0; j<n; j++)
+        buf[i++] = digits[j];
+    return i;
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "LogChunk.h"
+#include "ByteOrder.h"
+
+// Nibble table for the reflected 0xEDB88320 polynomial, small enough
+// for flash and still only two lookups per byte
+static const uint32_t crcTable[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+uint32_t crc32(uint32_t crc, const uint8_t* buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        crc = (crc >> 4) ^ crcTable[crc & 0x0f];
+        crc = (crc >> 4) ^ crcTable[crc & 0x0f];
+    }
+    return ~crc;
+}
+
+void encodeLogChunkTrailer(uint8_t* buf, uint8_t flags, uint16_t samples, uint32_t first, uint32_t crc, uint32_t total) {
+    uint8_t* p = buf;
+
+    *p++ = LOG_CHUNK_SYNC;
+    *p++ = flags;
+    p = put16(p, samples);
+    p = put32(p, first);
+    p = put32(p, crc);
+    put32(p, total);
+}
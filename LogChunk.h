@@ -0,0 +1,56 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef LOG_CHUNK_H
+#define LOG_CHUNK_H
+
+#include <stdint.h>
+
+// Binary log download.
+//
+// A range of samples is sent as chunks of up to LOG_CHUNK_SAMPLES. Each
+// chunk is the raw little-endian int16 x,y,z data straight from the log
+// memory, followed by a trailer. The chunk ends the USB transfer: with
+// the trailer in a short packet, or with a zero-length packet when the
+// trailer fills the last one, as it does for 8 samples. LOG_CHUNK_SAMPLES*6
+// is a multiple of the 64-byte bulk packet size, so the payload of a full
+// chunk needs no copying.
+//
+// Trailer, all fields little-endian:
+//
+//   offset  size  field
+//   0       1     sync byte (LOG_CHUNK_SYNC)
+//   1       1     flags (LOG_CHUNK_LAST on the final chunk of a request)
+//   2       2     samples in this chunk
+//   4       4     index of the first sample in this chunk
+//   8       4     CRC-32 (IEEE 802.3) of the chunk payload
+//   12      4     total samples in the log
+//
+// A host that sees a bad CRC or a missing index re-requests just that
+// range with {'GETBIN':[offset,length]}.
+#define LOG_CHUNK_SAMPLES       64
+#define LOG_CHUNK_SYNC          0xE6
+#define LOG_CHUNK_LAST          (1 << 0)
+#define LOG_CHUNK_TRAILER_SIZE  16
+
+// Incremental CRC-32, start with crc = 0
+uint32_t crc32(uint32_t crc, const uint8_t* buf, uint32_t len);
+
+// Encode a chunk trailer into buf (LOG_CHUNK_TRAILER_SIZE bytes)
+void encodeLogChunkTrailer(uint8_t* buf, uint8_t flags, uint16_t samples, uint32_t first, uint32_t crc, uint32_t total);
+
+#endif
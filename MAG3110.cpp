@@ -0,0 +1,72 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "MAG3110.h"
+
+#define REG_OUT_X_MSB     0x01
+#define REG_WHO_AM_I      0x07
+#define REG_CTRL_REG1     0x10
+#define REG_CTRL_REG2     0x11
+
+#define WHO_AM_I_MAG3110  0xC4
+
+#define CTRL_REG1_ACTIVE  (1 << 0)
+#define CTRL_REG1_DR_80HZ (0 << 5)   // With 16x oversampling
+#define CTRL_REG2_AUTO_MRST_EN (1 << 7)
+
+#define I2C_FREQUENCY     400000
+
+MAG3110::MAG3110(PinName sda, PinName scl, int addr) : m_i2c(sda, scl), m_addr(addr) {
+    m_i2c.frequency(I2C_FREQUENCY);
+}
+
+bool MAG3110::enable() {
+    uint8_t id = 0;
+
+    readRegs(REG_WHO_AM_I, &id, 1);
+    if (id != WHO_AM_I_MAG3110)
+        return false;
+
+    // Reset the sensor before each measurement, so it does not drift
+    // from strong fields, then leave standby
+    writeReg(REG_CTRL_REG2, CTRL_REG2_AUTO_MRST_EN);
+    writeReg(REG_CTRL_REG1, CTRL_REG1_DR_80HZ | CTRL_REG1_ACTIVE);
+    return true;
+}
+
+void MAG3110::disable() {
+    writeReg(REG_CTRL_REG1, 0);
+}
+
+void MAG3110::getMagAllAxis(int16_t* xyz) {
+    uint8_t data[6];
+
+    readRegs(REG_OUT_X_MSB, data, sizeof(data));
+    for (int i = 0; i < 3; i++)
+        xyz[i] = (int16_t)((data[2*i] << 8) | data[2*i + 1]);
+}
+
+void MAG3110::readRegs(int addr, uint8_t* data, int len) {
+    char t[1] = {(char)addr};
+    m_i2c.write(m_addr, t, 1, true);
+    m_i2c.read(m_addr, (char*)data, len);
+}
+
+void MAG3110::writeReg(int addr, uint8_t value) {
+    char t[2] = {(char)addr, (char)value};
+    m_i2c.write(m_addr, t, 2);
+}
@@ -0,0 +1,50 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef MAG3110_H
+#define MAG3110_H
+
+#include "mbed.h"
+
+#define MAG3110_I2C_ADDRESS (0x0e<<1)
+
+// Minimal driver for the MAG3110 magnetometer on the FRDM-KL46Z.
+//
+// The sensor free-runs at its highest output data rate once enabled, so
+// getMagAllAxis() just fetches the latest x,y,z reading in one burst.
+// Values are raw 16-bit counts, 0.1 uT each.
+class MAG3110 {
+public:
+    MAG3110(PinName sda, PinName scl, int addr);
+
+    // Start continuous measurements, returns false if no MAG3110 answers
+    bool enable();
+
+    // Back to standby
+    void disable();
+
+    void getMagAllAxis(int16_t* xyz);
+
+private:
+    void readRegs(int addr, uint8_t* data, int len);
+    void writeReg(int addr, uint8_t value);
+
+    I2C m_i2c;
+    int m_addr;
+};
+
+#endif
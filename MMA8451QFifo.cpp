@@ -0,0 +1,112 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "MMA8451QFifo.h"
+
+#define REG_F_STATUS      0x00
+#define REG_OUT_X_MSB     0x01
+#define REG_F_SETUP       0x09
+#define REG_CTRL_REG1     0x2A
+
+#define F_STATUS_OVF      (1 << 7)
+#define F_STATUS_CNT_MASK 0x3F
+
+#define F_MODE_DISABLED   (0 << 6)
+#define F_MODE_FILL       (2 << 6)
+
+#define CTRL_REG1_ACTIVE  (1 << 0)
+#define CTRL_REG1_DR(n)   ((n) << 3)
+
+#define I2C_FREQUENCY     400000
+
+MMA8451QFifo::MMA8451QFifo(PinName sda, PinName scl, int addr) : m_i2c(sda, scl), m_addr(addr) {
+    m_i2c.frequency(I2C_FREQUENCY);
+}
+
+// CTRL_REG1 DR field for the supported output data rates
+static int dataRateBits(int rate) {
+    switch (rate) {
+        case 800: return 0;
+        case 400: return 1;
+        case 200: return 2;
+        case 100: return 3;
+        case 50:  return 4;
+        default:  return -1;
+    }
+}
+
+bool MMA8451QFifo::isValidRate(int rate) {
+    return dataRateBits(rate) >= 0;
+}
+
+bool MMA8451QFifo::enable(int rate, int watermark) {
+    int dr = dataRateBits(rate);
+    if (dr < 0 || watermark < 1 || watermark > MMA8451Q_FIFO_DEPTH)
+        return false;
+
+    // Configuration registers may only be changed in standby
+    writeReg(REG_CTRL_REG1, 0);
+    writeReg(REG_F_SETUP, F_MODE_FILL | watermark);
+    writeReg(REG_CTRL_REG1, CTRL_REG1_DR(dr) | CTRL_REG1_ACTIVE);
+    return true;
+}
+
+void MMA8451QFifo::disable() {
+    writeReg(REG_CTRL_REG1, 0);
+    writeReg(REG_F_SETUP, F_MODE_DISABLED);
+    writeReg(REG_CTRL_REG1, CTRL_REG1_ACTIVE);
+}
+
+int MMA8451QFifo::readFifo(int16_t* xyz, int maxSamples, bool* overflowed) {
+    uint8_t status;
+    uint8_t data[MMA8451Q_FIFO_DEPTH * 6];
+
+    readRegs(REG_F_STATUS, &status, 1);
+    *overflowed = (status & F_STATUS_OVF) != 0;
+
+    int count = status & F_STATUS_CNT_MASK;
+    if (count > maxSamples)
+        count = maxSamples;
+    if (count <= 0)
+        return 0;
+
+    // With the FIFO enabled the OUT_X_MSB..OUT_Z_LSB window wraps, so one
+    // burst read pops count samples.
+    readRegs(REG_OUT_X_MSB, data, count * 6);
+    for (int i = 0; i < count * 3; i++)
+        xyz[i] = (int16_t)((data[2*i] << 8) | data[2*i + 1]) >> 2;
+
+    return count;
+}
+
+void MMA8451QFifo::flush() {
+    int16_t xyz[MMA8451Q_FIFO_DEPTH * 3];
+    bool overflowed;
+
+    readFifo(xyz, MMA8451Q_FIFO_DEPTH, &overflowed);
+}
+
+void MMA8451QFifo::readRegs(int addr, uint8_t* data, int len) {
+    char t[1] = {(char)addr};
+    m_i2c.write(m_addr, t, 1, true);
+    m_i2c.read(m_addr, (char*)data, len);
+}
+
+void MMA8451QFifo::writeReg(int addr, uint8_t value) {
+    char t[2] = {(char)addr, (char)value};
+    m_i2c.write(m_addr, t, 2);
+}
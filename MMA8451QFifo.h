@@ -0,0 +1,61 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef MMA8451Q_FIFO_H
+#define MMA8451Q_FIFO_H
+
+#include "mbed.h"
+
+#define MMA8451Q_FIFO_DEPTH 32
+
+// High-rate capture through the MMA8451Q 32-sample hardware FIFO.
+//
+// The MMA8451Q library only exposes single-sample reads, so this talks
+// to the same device on the same bus directly. While enabled the FIFO
+// runs in fill mode with a watermark, and readFifo() empties it with a
+// single burst read. Samples use the same 14-bit scaling as
+// MMA8451Q::getAccAllAxis().
+class MMA8451QFifo {
+public:
+    MMA8451QFifo(PinName sda, PinName scl, int addr);
+
+    // Returns true if rate (Hz) is an output data rate the sensor supports
+    static bool isValidRate(int rate);
+
+    // Put the sensor in FIFO mode at rate Hz with the given watermark
+    bool enable(int rate, int watermark);
+
+    // Back to single-sample mode as left by the MMA8451Q library
+    void disable();
+
+    // Drain up to maxSamples x,y,z triplets into xyz. Returns the number
+    // of samples read; overflowed is set if the FIFO filled up and
+    // samples were lost since the last read.
+    int readFifo(int16_t* xyz, int maxSamples, bool* overflowed);
+
+    // Discard everything queued so far, e.g. before a capture starts
+    void flush();
+
+private:
+    void readRegs(int addr, uint8_t* data, int len);
+    void writeReg(int addr, uint8_t value);
+
+    I2C m_i2c;
+    int m_addr;
+};
+
+#endif
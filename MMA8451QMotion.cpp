@@ -0,0 +1,160 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "MMA8451QMotion.h"
+
+#define REG_INT_SOURCE    0x0C
+#define REG_FF_MT_CFG     0x15
+#define REG_FF_MT_SRC     0x16
+#define REG_FF_MT_THS     0x17
+#define REG_FF_MT_COUNT   0x18
+#define REG_TRANSIENT_CFG 0x1D
+#define REG_TRANSIENT_SRC 0x1E
+#define REG_TRANSIENT_THS 0x1F
+#define REG_TRANSIENT_COUNT 0x20
+#define REG_PULSE_CFG     0x21
+#define REG_PULSE_SRC     0x22
+#define REG_PULSE_THSX    0x23
+#define REG_PULSE_THSY    0x24
+#define REG_PULSE_THSZ    0x25
+#define REG_PULSE_TMLT    0x26
+#define REG_PULSE_LTCY    0x27
+#define REG_CTRL_REG1     0x2A
+#define REG_CTRL_REG4     0x2D
+#define REG_CTRL_REG5     0x2E
+
+#define CTRL_REG1_ACTIVE  (1 << 0)
+
+// CTRL_REG4 enables an interrupt, CTRL_REG5 routes it to INT1 when set
+#define INT_FF_MT         (1 << 2)
+#define INT_PULSE         (1 << 3)
+#define INT_TRANS         (1 << 5)
+
+#define FF_MT_CFG_ELE     (1 << 7)   // Latch the event until FF_MT_SRC is read
+#define FF_MT_CFG_XYZ     (7 << 3)
+#define TRANSIENT_CFG_ELE (1 << 4)
+#define TRANSIENT_CFG_XYZ (7 << 1)
+#define PULSE_CFG_ELE     (1 << 6)
+#define PULSE_CFG_XYZ_SINGLE 0x15
+
+#define MG_PER_COUNT      63         // Threshold resolution, 0.063 g
+#define THRESHOLD_MAX     127
+
+#define I2C_FREQUENCY     400000
+
+MMA8451QMotion::MMA8451QMotion(PinName sda, PinName scl, int addr) : m_i2c(sda, scl), m_addr(addr), m_ctrl1(0) {
+    m_i2c.frequency(I2C_FREQUENCY);
+}
+
+static int thresholdCounts(int thresholdMg) {
+    int ths = (thresholdMg + MG_PER_COUNT/2) / MG_PER_COUNT;
+
+    if (ths < 1)
+        ths = 1;
+    if (ths > THRESHOLD_MAX)
+        ths = THRESHOLD_MAX;
+    return ths;
+}
+
+int MMA8451QMotion::programmedMg(int thresholdMg) {
+    return thresholdCounts(thresholdMg) * MG_PER_COUNT;
+}
+
+bool MMA8451QMotion::enable(int event, int thresholdMg, int count) {
+    int ths = thresholdCounts(thresholdMg);
+    uint8_t irq;
+
+    if (count < 0)
+        count = 0;
+    if (count > 255)
+        count = 255;
+
+    // Configuration registers may only be changed in standby
+    standby(true);
+    switch (event) {
+        case MMA8451Q_TRANSIENT:
+            writeReg(REG_TRANSIENT_CFG, TRANSIENT_CFG_ELE | TRANSIENT_CFG_XYZ);
+            writeReg(REG_TRANSIENT_THS, ths);
+            writeReg(REG_TRANSIENT_COUNT, count);
+            irq = INT_TRANS;
+            break;
+        case MMA8451Q_FREEFALL:
+            // With OAE clear the axes are ANDed, all must be below the threshold
+            writeReg(REG_FF_MT_CFG, FF_MT_CFG_ELE | FF_MT_CFG_XYZ);
+            writeReg(REG_FF_MT_THS, ths);
+            writeReg(REG_FF_MT_COUNT, count);
+            irq = INT_FF_MT;
+            break;
+        case MMA8451Q_PULSE:
+            writeReg(REG_PULSE_CFG, PULSE_CFG_ELE | PULSE_CFG_XYZ_SINGLE);
+            writeReg(REG_PULSE_THSX, ths);
+            writeReg(REG_PULSE_THSY, ths);
+            writeReg(REG_PULSE_THSZ, ths);
+            writeReg(REG_PULSE_TMLT, count);
+            writeReg(REG_PULSE_LTCY, 0);
+            irq = INT_PULSE;
+            break;
+        default:
+            standby(false);
+            return false;
+    }
+    writeReg(REG_CTRL_REG4, irq);
+    writeReg(REG_CTRL_REG5, irq);
+    standby(false);
+    return true;
+}
+
+void MMA8451QMotion::disable() {
+    standby(true);
+    writeReg(REG_CTRL_REG4, 0);
+    writeReg(REG_TRANSIENT_CFG, 0);
+    writeReg(REG_FF_MT_CFG, 0);
+    writeReg(REG_PULSE_CFG, 0);
+    standby(false);
+    clear();
+}
+
+uint8_t MMA8451QMotion::clear() {
+    uint8_t source, src;
+
+    readRegs(REG_INT_SOURCE, &source, 1);
+    readRegs(REG_TRANSIENT_SRC, &src, 1);
+    readRegs(REG_FF_MT_SRC, &src, 1);
+    readRegs(REG_PULSE_SRC, &src, 1);
+    return source;
+}
+
+// Keeps the data rate and FIFO mode set up by the others
+void MMA8451QMotion::standby(bool on) {
+    if (on) {
+        readRegs(REG_CTRL_REG1, &m_ctrl1, 1);
+        writeReg(REG_CTRL_REG1, m_ctrl1 & ~CTRL_REG1_ACTIVE);
+    } else {
+        writeReg(REG_CTRL_REG1, m_ctrl1 | CTRL_REG1_ACTIVE);
+    }
+}
+
+void MMA8451QMotion::readRegs(int addr, uint8_t* data, int len) {
+    char t[1] = {(char)addr};
+    m_i2c.write(m_addr, t, 1, true);
+    m_i2c.read(m_addr, (char*)data, len);
+}
+
+void MMA8451QMotion::writeReg(int addr, uint8_t value) {
+    char t[2] = {(char)addr, (char)value};
+    m_i2c.write(m_addr, t, 2);
+}
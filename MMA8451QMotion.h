@@ -0,0 +1,66 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef MMA8451Q_MOTION_H
+#define MMA8451Q_MOTION_H
+
+#include "mbed.h"
+
+// Events the MMA8451Q can detect on its own
+#define MMA8451Q_TRANSIENT  1   // High-pass filtered acceleration above the threshold on any axis
+#define MMA8451Q_FREEFALL   2   // Acceleration below the threshold on all axes
+#define MMA8451Q_PULSE      3   // Single tap above the threshold on any axis
+
+#define MMA8451Q_MOTION_MAX_MG  (127*63)  // Highest threshold, 127 steps of 0.063 g
+
+// Event detection through the MMA8451Q interrupt engines.
+//
+// Like MMA8451QFifo this talks to the sensor directly, next to the
+// MMA8451Q library. The enabled event pulls INT1 low and keeps it low
+// until clear() reads the event source, so the MCU can sleep and be
+// woken by the pin instead of polling the sensor.
+class MMA8451QMotion {
+public:
+    MMA8451QMotion(PinName sda, PinName scl, int addr);
+
+    // Detect event on INT1. thresholdMg is in mg, count is the debounce
+    // (the time limit for MMA8451Q_PULSE) in output data rate periods.
+    // Returns false for an unknown event.
+    bool enable(int event, int thresholdMg, int count);
+
+    // The threshold enable() programs for thresholdMg, rounded to the
+    // sensor's 63 mg steps and clamped to 63..MMA8451Q_MOTION_MAX_MG
+    static int programmedMg(int thresholdMg);
+
+    // Turn all event detection off
+    void disable();
+
+    // Read and clear the interrupt source, releasing INT1. Returns the
+    // INT_SOURCE register.
+    uint8_t clear();
+
+private:
+    void standby(bool on);
+    void readRegs(int addr, uint8_t* data, int len);
+    void writeReg(int addr, uint8_t value);
+
+    I2C m_i2c;
+    int m_addr;
+    uint8_t m_ctrl1;  // CTRL_REG1 to restore when leaving standby
+};
+
+#endif
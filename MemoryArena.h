@@ -0,0 +1,63 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef MEMORY_ARENA_H
+#define MEMORY_ARENA_H
+
+#include <stdint.h>
+
+// Bump allocator over one block of RAM, sized once at boot.
+//
+// The large buffers are carved out of the block at boot and never
+// freed, so there is no heap fragmentation and nothing that can fail to
+// allocate later on. The block is the free RAM found from the linker
+// script symbols and claimed from the heap, or a static array the linker
+// checks, see sizeArena() in main.cpp. The last user takes whatever is left.
+class MemoryArena {
+public:
+    MemoryArena(void* base, uint32_t size)
+        : m_base((uint8_t*)base), m_size(size), m_used(0) {
+    }
+
+    // Word aligned block of size bytes, 0 if it does not fit
+    void* allocate(uint32_t size) {
+        size = (size + 3) & ~3;
+        if (size > m_size - m_used)
+            return 0;
+        void* p = m_base + m_used;
+        m_used += size;
+        return p;
+    }
+
+    // All of the arena not allocated yet, its length in bytes goes to size
+    void* allocateRest(uint32_t* size) {
+        void* p = m_base + m_used;
+        *size = m_size - m_used;
+        m_used = m_size;
+        return p;
+    }
+
+    uint32_t size() const { return m_size; }
+    uint32_t used() const { return m_used; }
+
+private:
+    uint8_t* m_base;
+    uint32_t m_size;
+    uint32_t m_used;
+};
+
+#endif
@@ -0,0 +1,106 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include <string.h>
+
+#include "PacketWriter.h"
+#include "IntText.h"
+#include "us_ticker_api.h"
+
+PacketWriter::PacketWriter(WebUSBCDC& usb, bool isCDC, bool discard)
+    : m_usb(usb), m_cdc(isCDC), m_discard(discard), m_bytes(0), m_packets(0), m_lastFull(false), m_len(0) {
+    m_sendTime.reset();
+}
+
+void PacketWriter::resetStats() {
+    m_bytes = 0;
+    m_packets = 0;
+    m_sendTime.reset();
+}
+
+void PacketWriter::sendPacket() {
+    send(m_buf, m_len);
+    m_len = 0;
+}
+
+void PacketWriter::send(const uint8_t* buf, uint32_t len) {
+    if (!m_discard) {
+        uint32_t start = us_ticker_read();
+        m_usb.write((uint8_t*)buf, len, m_cdc);
+        m_sendTime.add(us_ticker_read() - start);
+    }
+    m_bytes += len;
+    m_packets++;
+    m_lastFull = (len == sizeof(m_buf));
+}
+
+void PacketWriter::write(const uint8_t* buf, uint32_t len) {
+    // Full packets straight from the caller's memory when nothing is staged
+    while (m_len == 0 && len >= sizeof(m_buf)) {
+        send(buf, sizeof(m_buf));
+        buf += sizeof(m_buf);
+        len -= sizeof(m_buf);
+    }
+    while (len > 0) {
+        uint32_t byte_count = sizeof(m_buf) - m_len;
+        if (byte_count > len)
+            byte_count = len;
+        memcpy(&m_buf[m_len], buf, byte_count);
+        m_len += byte_count;
+        buf += byte_count;
+        len -= byte_count;
+        if (m_len == sizeof(m_buf))
+            sendPacket();
+    }
+}
+
+void PacketWriter::print(const char* str) {
+    while (*str)
+        putChar(*str++);
+}
+
+void PacketWriter::printInt(int32_t value) {
+    char text[11];
+    write((const uint8_t*)text, intToText<0,' '>(value, text));
+}
+
+void PacketWriter::printUInt(uint32_t value) {
+    char text[10];
+    write((const uint8_t*)text, uintToText(value, text));
+}
+
+void PacketWriter::printHex(uint32_t value, int digits) {
+    static const char hex[] = "0123456789ABCDEF";
+    int shift = 28;
+
+    // Skip leading zeros beyond the requested width, like %0*X
+    while (shift >= 4*digits && !(value >> shift))
+        shift -= 4;
+    for (; shift >= 0; shift -= 4)
+        putChar(hex[(value >> shift) & 0xf]);
+}
+
+void PacketWriter::flush() {
+    if (m_len)
+        sendPacket();
+}
+
+void PacketWriter::endTransfer() {
+    flush();
+    if (m_lastFull)
+        send(m_buf, 0);
+}
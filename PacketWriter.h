@@ -0,0 +1,77 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef PACKET_WRITER_H
+#define PACKET_WRITER_H
+
+#include "WebUSBCDC.h"
+#include "Stats.h"
+
+// Coalescing output stage in front of WebUSBCDC::write.
+//
+// Everything is appended to a staging buffer of one bulk packet and only
+// full packets are sent. Callers flush() at message boundaries, so a
+// message built from many small pieces still goes out as the fewest
+// possible packets. Numbers are formatted straight into the buffer.
+//
+// A discarding writer formats and counts like a real one but never
+// touches the USB device, which is what the benchmarks measure with.
+class PacketWriter {
+public:
+    PacketWriter(WebUSBCDC& usb, bool isCDC=false, bool discard=false);
+
+    void write(const uint8_t* buf, uint32_t len);
+    void print(const char* str);
+    void printInt(int32_t value);
+    void printUInt(uint32_t value);
+    void printHex(uint32_t value, int digits);  // upper case, zero padded to digits
+
+    // Send the partial packet, if any
+    void flush();
+    // Flush and end the USB transfer there, with a zero-length packet if
+    // the last one was full, so a host reading more returns right away
+    void endTransfer();
+
+    uint32_t pending() const { return m_len; }
+
+    // Totals since start or resetStats(), including bytes still pending
+    uint32_t bytesWritten() const { return m_bytes + m_len; }
+    uint32_t packetsSent() const { return m_packets; }
+    const TimeStat& sendTime() const { return m_sendTime; }  // us blocked in USB writes
+    void resetStats();
+
+private:
+    void putChar(char c) {
+        m_buf[m_len++] = c;
+        if (m_len == sizeof(m_buf))
+            sendPacket();
+    }
+    void sendPacket();
+    void send(const uint8_t* buf, uint32_t len);
+
+    WebUSBCDC& m_usb;
+    bool m_cdc;
+    bool m_discard;
+    uint32_t m_bytes;
+    uint32_t m_packets;
+    bool m_lastFull;  // The last packet sent was a full one
+    TimeStat m_sendTime;
+    uint8_t m_buf[MAX_PACKET_SIZE_EPBULK];
+    uint32_t m_len;
+};
+
+#endif
@@ -0,0 +1,54 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+#include "SampleClock.h"
+#include "us_ticker_api.h"
+
+SampleClock::SampleClock()
+    : m_fptr(0), m_rate(1), m_whole(0), m_remainder(0), m_error(0), m_deadline(0) {
+}
+
+void SampleClock::attach(void (*fptr)(void), uint32_t rate, uint32_t samples) {
+    remove();
+    m_fptr = fptr;
+    m_rate = rate;
+    m_whole = (1000000 * samples) / rate;
+    m_remainder = (1000000 * samples) % rate;
+    m_error = 0;
+    m_deadline = us_ticker_read();
+    scheduleNext();
+}
+
+void SampleClock::detach() {
+    remove();
+    m_fptr = 0;
+}
+
+void SampleClock::scheduleNext() {
+    m_deadline += m_whole;
+    m_error += m_remainder;
+    if (m_error >= m_rate) {
+        m_error -= m_rate;
+        m_deadline++;
+    }
+    insert(m_deadline);
+}
+
+void SampleClock::handler() {
+    scheduleNext();
+    if (m_fptr)
+        m_fptr();
+}
@@ -0,0 +1,51 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+#ifndef SAMPLE_CLOCK_H
+#define SAMPLE_CLOCK_H
+
+#include "mbed.h"
+
+// Periodic interrupt at an exact sampling rate.
+//
+// Ticker only takes a whole number of microseconds, so a rate like 3 or
+// 7 Hz runs slightly fast and the error adds up sample after sample.
+// SampleClock keeps the remainder of 1000000/rate and spreads it over
+// the ticks, Bresenham style, so every deadline is the ideal one rounded
+// to the microsecond. Each deadline is scheduled from the previous
+// deadline, not from when the handler ran, so interrupt latency does
+// not accumulate either.
+class SampleClock : public TimerEvent {
+public:
+    SampleClock();
+
+    // Call fptr every samples/rate seconds, starting one period from now
+    void attach(void (*fptr)(void), uint32_t rate, uint32_t samples=1);
+    void detach();
+
+private:
+    virtual void handler();
+    void scheduleNext();
+
+    void (*m_fptr)(void);
+    uint32_t m_rate;
+    uint32_t m_whole;      // Whole microseconds per period
+    uint32_t m_remainder;  // Fraction of a microsecond per period, in 1/rate units
+    uint32_t m_error;
+    timestamp_t m_deadline;
+};
+
+#endif
@@ -0,0 +1,125 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <stdint.h>
+
+// Lock-free single-producer ring buffer with up to R readers.
+//
+// The producer (typically an ISR) only ever writes head, each reader
+// (the main loop, once per consumer) only ever writes its own tail, so
+// no locking is needed on a single core. Every reader sees every item
+// without it being copied per reader. N must be a power of two; the
+// indices run freely and are masked on access, which lets all N slots
+// be used.
+//
+// A slot is reused once all attached readers are past it. When the
+// slowest reader is N items behind the new item is dropped (the readers
+// own the old ones) and the overrun counter is incremented. Readers
+// start detached, and detached readers hold nothing back.
+template<typename T, uint32_t N, uint32_t R = 1>
+class SampleRing {
+public:
+    SampleRing() : head(0), attached(0), overruns(0) {
+        for (uint32_t r=0; r<R; r++)
+            tail[r] = 0;
+    }
+
+    // Producer side
+    bool push(const T& item) {
+        uint32_t h = head;
+        if (used(h) >= N) {
+            overruns++;
+            return false;
+        }
+        buf[h & (N - 1)] = item;
+        barrier();  // item must be visible before the new head
+        head = h + 1;
+        return true;
+    }
+
+    // Reader side
+    bool pop(T* item, uint32_t reader = 0) {
+        const T* next = peek(reader);
+        if (!next)
+            return false;
+        *item = *next;
+        advance(reader);
+        return true;
+    }
+
+    // Oldest unread item in place, valid until advance()
+    const T* peek(uint32_t reader = 0) const {
+        uint32_t t = tail[reader];
+        if (head == t)
+            return 0;
+        barrier();
+        return &buf[t & (N - 1)];
+    }
+
+    void advance(uint32_t reader = 0) {
+        barrier();  // slot must be read before it is handed back
+        tail[reader] = tail[reader] + 1;
+    }
+
+    uint32_t count(uint32_t reader = 0) const { return head - tail[reader]; }
+    uint32_t capacity() const { return N; }
+    uint32_t overrunCount() const { return overruns; }
+
+    // Start reading from the newest item on
+    void attach(uint32_t reader) {
+        tail[reader] = head;
+        barrier();
+        attached |= 1 << reader;
+    }
+
+    void detach(uint32_t reader) {
+        attached &= ~(1 << reader);
+    }
+
+    // Only call while the producer is stopped
+    void reset() {
+        head = 0;
+        for (uint32_t r=0; r<R; r++)
+            tail[r] = 0;
+        overruns = 0;
+    }
+
+private:
+    typedef char n_must_be_power_of_two[(N & (N - 1)) == 0 ? 1 : -1];
+
+    static inline void barrier() { __asm volatile ("" ::: "memory"); }
+
+    // Items the slowest attached reader has not read yet
+    uint32_t used(uint32_t h) const {
+        uint32_t most = 0;
+        for (uint32_t r=0; r<R; r++) {
+            if ((attached & (1 << r)) && h - tail[r] > most)
+                most = h - tail[r];
+        }
+        return most;
+    }
+
+    T buf[N];
+    volatile uint32_t head;
+    volatile uint32_t tail[R];
+    volatile uint32_t attached;
+    volatile uint32_t overruns;
+};
+
+#endif
@@ -0,0 +1,75 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "SensorScheduler.h"
+
+SensorScheduler::SensorScheduler() : m_tickRate(0), m_enabled(0) {
+    for (int i=0; i<SENSOR_SCHEDULER_SLOTS; i++) {
+        m_rate[i] = 0;
+        m_phase[i] = 0;
+        m_order[i] = i;
+    }
+}
+
+void SensorScheduler::setRate(int sensor, uint32_t rate) {
+    if (sensor < 0 || sensor >= SENSOR_SCHEDULER_SLOTS)
+        return;
+
+    m_rate[sensor] = rate;
+    m_tickRate = 0;
+    m_enabled = 0;
+    for (int i=0; i<SENSOR_SCHEDULER_SLOTS; i++) {
+        if (m_rate[i] > m_tickRate)
+            m_tickRate = m_rate[i];
+        if (m_rate[i])
+            m_enabled |= 1 << i;
+    }
+
+    // Insertion sort by falling rate, ties keep the sensor order
+    for (int i=0; i<SENSOR_SCHEDULER_SLOTS; i++)
+        m_order[i] = i;
+    for (int i=1; i<SENSOR_SCHEDULER_SLOTS; i++) {
+        uint8_t s = m_order[i];
+        int j = i;
+        while (j > 0 && m_rate[m_order[j-1]] < m_rate[s]) {
+            m_order[j] = m_order[j-1];
+            j--;
+        }
+        m_order[j] = s;
+    }
+    restart();
+}
+
+void SensorScheduler::restart() {
+    for (int i=0; i<SENSOR_SCHEDULER_SLOTS; i++)
+        m_phase[i] = m_rate[i] ? m_tickRate - m_rate[i] : 0;
+}
+
+uint8_t SensorScheduler::tick() {
+    uint8_t due = 0;
+
+    for (int i=0; i<SENSOR_SCHEDULER_SLOTS; i++) {
+        if (!m_rate[i])
+            continue;
+        m_phase[i] += m_rate[i];
+        if (m_phase[i] >= m_tickRate) {
+            m_phase[i] -= m_tickRate;
+            due |= 1 << i;
+        }
+    }
+    return due;
+}
@@ -0,0 +1,65 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef SENSOR_SCHEDULER_H
+#define SENSOR_SCHEDULER_H
+
+#include <stdint.h>
+
+#define SENSOR_SCHEDULER_SLOTS 8  // Sensors are the bits of a uint8_t mask
+
+// Rate-monotonic sensor scheduler.
+//
+// Every sensor has its own rate. The scheduler ticks at the rate of the
+// fastest one and tells which sensors are due on each tick, so the due
+// sensors are read once into a frame sharing the tick's timestamp.
+// Slower sensors are spread over the ticks Bresenham style, which keeps
+// their average rate exact even when it does not divide the tick rate.
+// Due sensors should be read in priority order, fastest first, so the
+// sensor with the shortest period sees the least jitter.
+class SensorScheduler {
+public:
+    SensorScheduler();
+
+    // Set the rate of sensor in Hz, 0 turns it off
+    void setRate(int sensor, uint32_t rate);
+    uint32_t rate(int sensor) const { return m_rate[sensor]; }
+
+    // Rate of the fastest sensor, 0 when all are off
+    uint32_t tickRate() const { return m_tickRate; }
+
+    // Sensors with a non-zero rate
+    uint8_t enabled() const { return m_enabled; }
+
+    // Sensor at priority position i, 0 is the fastest
+    int byPriority(int i) const { return m_order[i]; }
+
+    // Make every enabled sensor due on the next tick
+    void restart();
+
+    // Advance one tick, returns the mask of the sensors due on it
+    uint8_t tick();
+
+private:
+    uint32_t m_rate[SENSOR_SCHEDULER_SLOTS];
+    uint32_t m_phase[SENSOR_SCHEDULER_SLOTS];
+    uint8_t m_order[SENSOR_SCHEDULER_SLOTS];
+    uint32_t m_tickRate;
+    uint8_t m_enabled;
+};
+
+#endif
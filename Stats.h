@@ -0,0 +1,74 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+// Runtime instrumentation, cheap enough to stay enabled: every update is
+// a few adds and compares, no division.
+
+// Count, total and worst case of a measured duration
+struct TimeStat {
+    uint32_t count;
+    uint32_t total;
+    uint32_t max;
+
+    void add(uint32_t t) {
+        count++;
+        total += t;
+        if (t > max)
+            max = t;
+    }
+    void reset() {
+        count = 0;
+        total = 0;
+        max = 0;
+    }
+};
+
+// Histogram of timing errors by magnitude. Bin 0 counts errors below
+// 2^STATS_ERROR_SHIFT us, every further bin doubles the range and the
+// last bin takes everything larger.
+#define STATS_ERROR_BINS 12
+#define STATS_ERROR_SHIFT 3
+
+struct ErrorHistogram {
+    uint32_t bins[STATS_ERROR_BINS];
+    uint32_t max;
+
+    void add(int32_t error) {
+        uint32_t e = (error < 0) ? -error : error;
+        int bin = 0;
+
+        if (e > max)
+            max = e;
+        e >>= STATS_ERROR_SHIFT;
+        while (e && bin < STATS_ERROR_BINS-1) {
+            e >>= 1;
+            bin++;
+        }
+        bins[bin]++;
+    }
+    void reset() {
+        for (int i=0; i<STATS_ERROR_BINS; i++)
+            bins[i] = 0;
+        max = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,94 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "StreamFrame.h"
+#include "ByteOrder.h"
+
+uint32_t streamFrameSize(uint8_t mask) {
+    uint32_t size = STREAM_FRAME_HEADER_SIZE;
+    if (mask & STREAM_FRAME_TOUCH)
+        size += 2;
+    if (mask & STREAM_FRAME_ACC)
+        size += 6;
+    if (mask & STREAM_FRAME_MAG)
+        size += 6;
+    if (mask & STREAM_FRAME_LIGHT)
+        size += 2;
+    return size;
+}
+
+uint32_t encodeStreamFrame(const StreamFrame* frame, uint8_t* buf) {
+    uint8_t* p = buf;
+
+    *p++ = STREAM_FRAME_SYNC;
+    *p++ = frame->mask;
+    p = put16(p, frame->seq);
+    p = put32(p, frame->timestamp);
+    if (frame->mask & STREAM_FRAME_TOUCH)
+        p = put16(p, (uint16_t)frame->touch);
+    if (frame->mask & STREAM_FRAME_ACC) {
+        p = put16(p, (uint16_t)frame->acc[0]);
+        p = put16(p, (uint16_t)frame->acc[1]);
+        p = put16(p, (uint16_t)frame->acc[2]);
+    }
+    if (frame->mask & STREAM_FRAME_MAG) {
+        p = put16(p, (uint16_t)frame->mag[0]);
+        p = put16(p, (uint16_t)frame->mag[1]);
+        p = put16(p, (uint16_t)frame->mag[2]);
+    }
+    if (frame->mask & STREAM_FRAME_LIGHT)
+        p = put16(p, frame->light);
+    return p - buf;
+}
+
+uint32_t decodeStreamFrame(const uint8_t* buf, uint32_t len, StreamFrame* frame) {
+    if (len < STREAM_FRAME_HEADER_SIZE || buf[0] != STREAM_FRAME_SYNC)
+        return 0;
+
+    uint32_t size = streamFrameSize(buf[1]);
+    if (len < size)
+        return 0;
+
+    const uint8_t* p = buf + 2;
+    frame->mask = buf[1];
+    frame->seq = get16(p);
+    frame->timestamp = get32(p + 2);
+    p += 6;
+    frame->touch = 0;
+    frame->acc[0] = frame->acc[1] = frame->acc[2] = 0;
+    frame->mag[0] = frame->mag[1] = frame->mag[2] = 0;
+    frame->light = 0;
+    if (frame->mask & STREAM_FRAME_TOUCH) {
+        frame->touch = (int16_t)get16(p);
+        p += 2;
+    }
+    if (frame->mask & STREAM_FRAME_ACC) {
+        frame->acc[0] = (int16_t)get16(p);
+        frame->acc[1] = (int16_t)get16(p + 2);
+        frame->acc[2] = (int16_t)get16(p + 4);
+        p += 6;
+    }
+    if (frame->mask & STREAM_FRAME_MAG) {
+        frame->mag[0] = (int16_t)get16(p);
+        frame->mag[1] = (int16_t)get16(p + 2);
+        frame->mag[2] = (int16_t)get16(p + 4);
+        p += 6;
+    }
+    if (frame->mask & STREAM_FRAME_LIGHT)
+        frame->light = get16(p);
+    return size;
+}
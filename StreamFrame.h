@@ -0,0 +1,82 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef STREAM_FRAME_H
+#define STREAM_FRAME_H
+
+#include <stdint.h>
+
+// Compact binary StreamData frame, all fields little-endian.
+//
+//   offset  size  field
+//   0       1     sync byte (STREAM_FRAME_SYNC)
+//   1       1     sensor mask (STREAM_FRAME_* bits)
+//   2       2     sequence number (wraps at 65535)
+//   4       4     timestamp in microseconds (free-running, wraps)
+//   8       2     touch value           - only if STREAM_FRAME_TOUCH is set
+//   ..      6     accelerometer x,y,z   - only if STREAM_FRAME_ACC is set
+//   ..      6     magnetometer x,y,z    - only if STREAM_FRAME_MAG is set
+//   ..      2     light level           - only if STREAM_FRAME_LIGHT is set
+//
+// The payload layout is fully determined by the mask, so a host can
+// walk a byte stream frame by frame without any length field.
+//
+// With a dead band (SETDBD) a sensor is only sent when it moves beyond
+// the band from its last sent value, and the host holds that value until
+// the next frame carrying the sensor. Keyframes (STREAM_FRAME_KEY) repeat
+// every held value at least once per SETKEY interval, so a sensor missing
+// for longer than that was lost, not unchanged.
+#define STREAM_FRAME_SYNC           0xE5
+
+// Sensors, each has mask bit 1 << its number
+#define STREAM_SENSOR_TOUCH         0
+#define STREAM_SENSOR_ACC           1
+#define STREAM_SENSOR_MAG           2
+#define STREAM_SENSOR_LIGHT         3
+#define STREAM_SENSOR_COUNT         4
+
+#define STREAM_FRAME_TOUCH          (1 << STREAM_SENSOR_TOUCH)
+#define STREAM_FRAME_ACC            (1 << STREAM_SENSOR_ACC)
+#define STREAM_FRAME_MAG            (1 << STREAM_SENSOR_MAG)
+#define STREAM_FRAME_LIGHT          (1 << STREAM_SENSOR_LIGHT)
+#define STREAM_FRAME_KEY            0x80  // Keyframe, carries no payload of its own
+
+#define STREAM_FRAME_HEADER_SIZE    8
+#define STREAM_FRAME_MAX_SIZE       (STREAM_FRAME_HEADER_SIZE + 2 + 6 + 6 + 2)
+
+struct StreamFrame {
+    uint8_t mask;
+    uint16_t seq;
+    uint32_t timestamp;
+    int16_t touch;
+    int16_t acc[3];
+    int16_t mag[3];
+    uint16_t light;
+};
+
+// Size in bytes of an encoded frame carrying the sensors in mask
+uint32_t streamFrameSize(uint8_t mask);
+
+// Encode frame into buf (at least STREAM_FRAME_MAX_SIZE bytes).
+// Returns the number of bytes written.
+uint32_t encodeStreamFrame(const StreamFrame* frame, uint8_t* buf);
+
+// Decode one frame from buf. Returns the number of bytes consumed, or 0
+// if buf does not start with a complete, valid frame.
+uint32_t decodeStreamFrame(const uint8_t* buf, uint32_t len, StreamFrame* frame);
+
+#endif
@@ -17,6 +17,7 @@
 */
 
 #include "stdint.h"
+#include <string.h>
 
 #include "USBHAL.h"
 #include "WebUSBCDC.h"
@@ -24,6 +25,7 @@
 #include "WinUSB.h"
 
 #include "USBDescriptor.h"
+#include "us_ticker_api.h"
 
 static uint8_t cdc_line_coding[7]= {0x80, 0x25, 0x00, 0x00, 0x00, 0x00, 0x08};
 
@@ -86,6 +88,11 @@ WebUSBCDC::WebUSBCDC(uint16_t vendor_id, uint16_t product_id, uint16_t product_r
     :  WebUSBDevice(vendor_id, product_id, product_release)
 {
     cdc_connected = false;
+    webusb_connected = false;
+    resetTx(cdc_tx);
+    resetTx(webusb_tx);
+    cdc_tx.dropped = 0;
+    webusb_tx.dropped = 0;
     if (connect) {
         WebUSBDevice::connect();
     }
@@ -185,12 +192,12 @@ bool WebUSBCDC::USBCallback_request() {
                 success = true;
                 break;
             case CDC_SET_CONTROL_LINE_STATE:
-                // we should handle this specifically for the CDC endpoint.
-                if (transfer->setup.wValue & CLS_DTR) {
-                    cdc_connected = true;
-                } else {
-                    cdc_connected = false;
-                }
+                // Sent to the CDC interface by terminals, and by WebUSB pages
+                // to the WebUSB interface to signal that they are listening
+                if (transfer->setup.wIndex == WEBUSB_INTERFACE_NUMBER)
+                    webusb_connected = (transfer->setup.wValue & CLS_DTR) != 0;
+                else
+                    cdc_connected = (transfer->setup.wValue & CLS_DTR) != 0;
                 success = true;
                 break;
             default:
@@ -226,14 +233,112 @@ bool WebUSBCDC::USBCallback_setConfiguration(uint8_t configuration) {
     // We activate the endpoints to be able to recceive data
     readStart(EPBULK_OUT, MAX_PACKET_SIZE_EPBULK);
     readStart(WEBUSB_ENDPOINT_OUT, MAX_PACKET_SIZE_EPBULK);
+
+    resetTx(cdc_tx);
+    resetTx(webusb_tx);
+    return true;
+}
+
+// Called in ISR context
+void WebUSBCDC::USBCallback_busReset() {
+    cdc_connected = false;
+    webusb_connected = false;
+    resetTx(cdc_tx);
+    resetTx(webusb_tx);
+}
+
+// Called in ISR context when the IN endpoint has sent a packet
+bool WebUSBCDC::EP2_IN_callback() {
+    txComplete(cdc_tx, CDC_ENDPOINT_IN);
+    return true;
+}
+
+bool WebUSBCDC::EP5_IN_callback() {
+    txComplete(webusb_tx, WEBUSB_ENDPOINT_IN);
+    return true;
+}
+
+void WebUSBCDC::resetTx(USBTxQueue& q) {
+    q.head = 0;
+    q.tail = 0;
+    q.busy = false;
+    q.stalled = false;
+}
+
+// Put the oldest queued packet on the endpoint, with interrupts disabled
+// or from the endpoint interrupt
+void WebUSBCDC::startTx(USBTxQueue& q, uint8_t endpoint) {
+    if (q.busy || q.head == q.tail)
+        return;
+
+    uint32_t slot = q.tail & (USB_TX_QUEUE_PACKETS - 1);
+    q.busy = (endpointWrite(endpoint, q.buf[slot], q.len[slot]) == EP_PENDING);
+    if (!q.busy)
+        q.tail++;  // Endpoint refused it, drop rather than retry forever
+}
+
+void WebUSBCDC::txComplete(USBTxQueue& q, uint8_t endpoint) {
+    endpointWriteResult(endpoint);  // clears the completion flag
+    if (!q.busy)
+        return;
+    q.busy = false;
+    q.stalled = false;
+    q.tail++;
+    startTx(q, endpoint);
+}
+
+uint32_t WebUSBCDC::txFree(bool isCDC) const {
+    const USBTxQueue& q = isCDC ? cdc_tx : webusb_tx;
+    return USB_TX_QUEUE_PACKETS - (q.head - q.tail);
+}
+
+bool WebUSBCDC::writeNB(uint8_t * buffer, uint32_t size, bool isCDC) {
+    USBTxQueue& q = isCDC ? cdc_tx : webusb_tx;
+    uint8_t endpoint = isCDC ? CDC_ENDPOINT_IN : WEBUSB_ENDPOINT_IN;
+
+    if (!connected(isCDC) || !configured() || size > MAX_CDC_REPORT_SIZE)
+        return false;
+
+    // A bus reset empties the queue from its interrupt, so the slot is
+    // filled and head moved with interrupts disabled
+    __disable_irq();
+    if (q.head - q.tail >= USB_TX_QUEUE_PACKETS) {
+        __enable_irq();
+        return false;
+    }
+    uint32_t slot = q.head & (USB_TX_QUEUE_PACKETS - 1);
+    memcpy(q.buf[slot], buffer, size);
+    q.len[slot] = size;
+    q.head++;
+    startTx(q, endpoint);
+    __enable_irq();
     return true;
 }
 
 bool WebUSBCDC::write(uint8_t * buffer, uint32_t size, bool isCDC) {
-    if(isCDC && !cdc_connected)
+    USBTxQueue& q = isCDC ? cdc_tx : webusb_tx;
+    uint32_t start = us_ticker_read();
+    uint32_t tail = q.tail;
+
+    if (size > MAX_CDC_REPORT_SIZE)
         return false;
 
-    return USBDevice::write(isCDC ? CDC_ENDPOINT_IN : WEBUSB_ENDPOINT_IN, buffer, size, MAX_CDC_REPORT_SIZE);
+    // A full queue only waits for a host that keeps taking packets
+    while (!writeNB(buffer, size, isCDC)) {
+        if (!connected(isCDC) || !configured()) {
+            q.dropped++;
+            return false;
+        }
+        if (q.tail != tail) {
+            tail = q.tail;
+            start = us_ticker_read();
+        } else if (q.stalled || us_ticker_read() - start > USB_TX_STALL_US) {
+            q.stalled = true;
+            q.dropped++;
+            return false;
+        }
+    }
+    return true;
 }
 
 bool WebUSBCDC::read(uint8_t * buffer, uint32_t * size, bool isCDC, bool blocking) {
@@ -247,6 +352,9 @@ bool WebUSBCDC::read(uint8_t * buffer, uint32_t * size, bool isCDC, bool blockin
     if (!readStart(isCDC ? CDC_ENDPOINT_OUT : WEBUSB_ENDPOINT_OUT, MAX_CDC_REPORT_SIZE))
         return false;
 
+    // A page that talks to us is listening, even if it never set DTR
+    if (!isCDC)
+        webusb_connected = true;
     return true;
 }
 
@@ -20,6 +20,22 @@
 
 #include "WebUSBDevice.h"
 
+#define USB_TX_QUEUE_PACKETS 8     // Per interface, must be a power of two
+#define USB_TX_STALL_US 2000       // A host that takes no packet for this long has stopped reading
+
+// Outgoing packets are queued per interface and sent from the endpoint
+// complete interrupt, so writing never waits for the host as long as
+// there is room in the queue.
+struct USBTxQueue {
+    uint8_t buf[USB_TX_QUEUE_PACKETS][MAX_PACKET_SIZE_EPBULK];
+    uint8_t len[USB_TX_QUEUE_PACKETS];
+    volatile uint32_t head;  // Next free slot, written by the main loop
+    volatile uint32_t tail;  // Oldest packet, on the endpoint while busy
+    volatile bool busy;
+    volatile bool stalled;   // Timed out, don't wait again until a packet completes
+    uint32_t dropped;        // Packets given up on by write()
+};
+
 class WebUSBCDC : public WebUSBDevice {
 public:
     WebUSBCDC(uint16_t vendor_id, uint16_t product_id, uint16_t product_release = 0x0001, bool connect = true);
@@ -27,6 +43,9 @@ public:
 protected:
     virtual bool USBCallback_request();
     virtual bool USBCallback_setConfiguration(uint8_t configuration);
+    virtual void USBCallback_busReset();
+    virtual bool EP2_IN_callback();
+    virtual bool EP5_IN_callback();
     virtual uint8_t * stringIproductDesc();
     virtual uint8_t * stringIinterfaceDesc();
     virtual uint8_t * configurationDesc();
@@ -34,15 +53,36 @@ protected:
     virtual uint8_t * stringIserialDesc();
 
 public:
+    // Queue a packet. A full queue waits for room only while the host
+    // takes a packet every USB_TX_STALL_US, and not at all once it has
+    // stalled, until a packet completes again. Returns
+    // false if the packet was dropped because the host is not connected
+    // or not reading.
     bool write(uint8_t * buffer, uint32_t size, bool isCDC=false);
+    // Queue a packet if there is room, never waits
+    bool writeNB(uint8_t * buffer, uint32_t size, bool isCDC=false);
     bool read(uint8_t * buffer, uint32_t * size, bool isCDC=false, bool blocking=false);
 
+    // CDC: the terminal has set DTR. WebUSB: the page has set DTR on the
+    // WebUSB interface or has sent a packet since the last reset.
+    bool connected(bool isCDC=false) const { return isCDC ? cdc_connected : webusb_connected; }
+    uint32_t txFree(bool isCDC=false) const;
+    uint32_t txDropped(bool isCDC=false) const { return isCDC ? cdc_tx.dropped : webusb_tx.dropped; }
+    void clearTxDropped() { cdc_tx.dropped = 0; webusb_tx.dropped = 0; }
+
     virtual uint8_t * allowedOriginsDesc();
     virtual uint8_t * urlIlandingPage();
     virtual uint8_t * urlIallowedOrigin();
 
 private:
+    void resetTx(USBTxQueue& q);
+    void startTx(USBTxQueue& q, uint8_t endpoint);
+    void txComplete(USBTxQueue& q, uint8_t endpoint);
+
     volatile bool cdc_connected;
+    volatile bool webusb_connected;
+    USBTxQueue cdc_tx;
+    USBTxQueue webusb_tx;
 };
 
 #endif
\ No newline at end of file
@@ -18,6 +18,9 @@
 #include "USBSerial.h"  // Virtual serial port
 #include "TSISensor.h"  // Touch sensor
 #include "MMA8451Q.h"   // Accelerometer
+#include "MMA8451QFifo.h"
+#include "MMA8451QMotion.h"
+#include "MAG3110.h"    // Magnetometer (KL46Z)
 
 #if !defined(MIN)
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -33,68 +36,107 @@
 #if defined(TARGET_KL25Z) | defined(TARGET_KL46Z)
 #define MMA8451_I2C_ADDRESS (0x1d<<1)
 MMA8451Q acc(PTE25, PTE24);
+MMA8451QFifo accFifo(PTE25, PTE24, MMA8451_I2C_ADDRESS);
+MMA8451QMotion accMotion(PTE25, PTE24, MMA8451_I2C_ADDRESS);
+#if defined(TARGET_KL25Z)
+InterruptIn accInt(PTA14);    // MMA8451Q INT1
+#else
+InterruptIn accInt(PTC5);
+#endif
+bool accHighRate = false;    // Sampling through the hardware FIFO (rates above MAX_SAMPLING_RATE)
+uint32_t accFifoOverflows = 0;
 int16_t *accLog = 0;
 int16_t *accLogPtr;
-int16_t accXYZ[3];
+int accLogLength = 0;         // Log capacity in samples, the memory arena left after the other buffers
+int accLogSize = 0;           // accLog length in int16_t, 3 per sample
 int accLoggedDataLength = 0;
+int accLogStart = 0;          // Sample index of the oldest logged sample, accLog wraps around
+int accLogPretrigger = 0;     // Samples in the current log recorded before the trigger
+uint32_t accLogTimestamp = 0; // us_ticker time of the first logged sample, the rest follow at the sampling rate
+int _acc_log_pretrigger = 0;  // Samples kept from before the trigger, 0 for one-shot logging
+int _acc_log_compress = 0;    // Delta compress one-shot logs to fit more samples
+int _acc_log_trigger = 0;     // What starts a log, 0 for a touch swipe or an MMA8451Q_* event
+int _acc_log_threshold = 500; // Motion trigger threshold in mg
+int _acc_log_count = 2;       // Motion trigger debounce, pulse time limit, in accelerometer periods
+int accLogTrigger = 0;        // Trigger settings of the current log, reported in its header
+int accLogThreshold = 0;
+int accLogCount = 0;
+int accLogDecimation = 1;     // Accelerometer reads per logged sample
+int accLogRate = 0;           // Sampling rate of the current log
 int _accelerometerRange = 8;
-int accelerometerStreaming = 0;
 #endif
 
 // Touch sensor
-int16_t touchValue = 0;
-int touchStreaming = 0;
 TSISensor tsi;
 
+// Magnetometer and light sensor
+#if defined(TARGET_KL46Z)
+MAG3110 mag(PTE25, PTE24, MAG3110_I2C_ADDRESS);
+AnalogIn lightSensor(PTE22);
+#endif
+
+// Highest streaming rates of the slower sensors, by default they follow
+// the accelerometer rate up to these
+#define TOUCH_MAX_RATE 100       // Each read waits for a TSI scan
+#define MAG_MAX_RATE 80          // MAG3110 output data rate
+#define LIGHT_MAX_RATE 100
+
 // Communication
-int sendNotifications = 0;
+uint16_t streamSequence = 0;
 
 #define DEFAULT_SAMPLING_RATE 50 // Sampling rate in Hz
-#define ACC_LOG_LENGTH (DEFAULT_SAMPLING_RATE*10) // Allow 10s sampling log for 50 Hz
-#define ACC_LOG_SIZE (ACC_LOG_LENGTH*3) // Allow 18s sampling log for 50 Hz
+#define MAX_SAMPLING_RATE 100    // Highest rate for single-sample reads, above this the FIFO is used
+#define ACC_FIFO_WATERMARK 16    // Samples per FIFO burst read in high-rate mode
 #define SAMPLING_WAIT (1000/DEFAULT_SAMPLING_RATE)
 #define SAMPLING_WAIT_US (1000*SAMPLING_WAIT)
 
-int _stream_sampling_rate = DEFAULT_SAMPLING_RATE;
-int _stream_sampling_wait_us = SAMPLING_WAIT_US;
+int _stream_sampling_rate = DEFAULT_SAMPLING_RATE;  // Sampler rate, the highest a session asked for
+int accSamplingRate = DEFAULT_SAMPLING_RATE;  // Accelerometer read rate, times the decimation of _stream_sampling_rate
+int accSamplingWaitUs = SAMPLING_WAIT_US;
+
+// RAM for the buffers sized at boot, see MemoryArena. Most of it is the
+// accelerometer log, so this sets the longest recording. With GCC the
+// arena is all RAM the linker script leaves free, less these reserves
+// for later heap allocations and the deepest stack (the benchmark and
+// a compressed GETBIN chunk, under 1 KB, plus interrupts).
+#define HEAP_RESERVE 1024
+#define STACK_RESERVE 2048
+// Toolchains without those linker symbols use a static block of this size
+#if defined(TARGET_KL25Z)
+#define MEMORY_ARENA_SIZE (8*1024)   // Of 16 KB
+#elif defined(TARGET_KL46Z)
+#define MEMORY_ARENA_SIZE (24*1024)  // Of 32 KB
+#endif
+
+#define DEFAULT_BATCH_SIZE 1        // Samples per USB packet flush
+#define MAX_BATCH_SIZE 32
+#define BATCH_MAX_LATENCY_US 50000  // Never hold a sample back longer than this
+#define DEFAULT_KEYFRAME_MS 1000    // Dead-banded sensors are repeated at least this often
+#define MAX_KEYFRAME_MS 60000
 
 enum STATE_TYPE
 {
     IDLE_STATE,
     LOG_ACC_STATE,
     ACC_READY_STATE,
+    ACC_LOGGING_STATE,
+    ACC_TRIGGERED_STATE,
     STREAM_TOUCH_STATE,
     STREAM_ACC_STATE,
     GET_INFO_STATE,
     GET_HELP_STATE,
     GET_LOG_STATE,
+    GET_BIN_STATE,
 };
 
 const char versionString[] = "17.07.002";
 
-char helpString[] =
-    "{\"msg\":["
-    "\"CMD => Description\","
-    "\"GETINF => Get hardware and firmware information, ({'GETINF':1})\","
-#if defined(TARGET_KL25Z)
-    "\"SETRGB => Set LED RGB color, e.g. send {'SETRGB':[255,0,0]}\","
-#elif defined(TARGET_KL46Z)
-    "\"SETLCD => Set LCD string, e.g. send {'SETLCD':'1234'}\","
-#endif
-    "\"NOTIFY => Send state change notifications ({'NOTIFY':x}, x = 0(off) or 1(on))\","
-    "\"SETRTE => Set sampling rate ({'SETRTE':x}, 1 <= x <= 100)\","
-    "\"STRTCH => Stream touch values ({'STRTCH':x}, x = 0(off) or 1(on))\","
-    "\"STRACC => Stream accelerometer values ({'STRTCH':x}, x = 0(off) or 1(on))\","
-    "\"LOGACC => Start logging accelerometer data ({'LOGACC':1})\","
-    "\"GETLOG => Get logged accelerometer data, ({'GETLOG':1})\","
-    "\"Visit www.empirikit.com for more information.\"]}";
-
 
 STATE_TYPE currentState;
 
 //Timers
-Timer timer;
-Timer loopTimer;
+Timer timer;        // Paces the LED/LCD animations
+#define UI_TICK_MS 100
 
 
 
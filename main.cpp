@@ -17,143 +17,2175 @@
 
 
 #include "mbed.h"
+#include "us_ticker_api.h"
 
 #include "empirikit.h"
 #include "WebUSBCDC.h"
+#include "StreamFrame.h"
+#include "SampleRing.h"
+#include "DeltaLog.h"
+#include "CommandParser.h"
+#include "CommandTable.h"
+#include "PacketWriter.h"
+#include "LogChunk.h"
+#include "CycleCounter.h"
+#include "SampleClock.h"
+#include "SensorScheduler.h"
+#include "CicDecimator.h"
+#include "Stats.h"
+#include "MemoryArena.h"
+#include "IntText.h"
+
+// Outcome of the command being handled, handlers that refuse it set this
+CMD_STATUS commandStatus = CMD_OK;
+bool commandDeferred = false;  // Set by a download, its Ack waits for the end
 
 #if defined(TARGET_KL46Z)
 #include "SLCD.h"
 
-SLCD lcd;
-char lcdMessage[40];
-#endif
+SLCD lcd;
+char lcdMessage[40];
+
+// Show prefix, value formatted like "%<Width>d" ("%0<Width>d" when Pad
+// is '0') and suffix
+template<int Width, char Pad>
+void lcdPrintInt(const char* prefix, int32_t value, const char* suffix) {
+    char* p = lcdMessage;
+
+    while (*prefix)
+        *p++ = *prefix++;
+    p += intToText<Width, Pad>(value, p);
+    while (*suffix)
+        *p++ = *suffix++;
+    *p = 0;
+    lcd.printf(lcdMessage);
+}
+
+void cmdStreamLight(const Command* cmd);
+void cmdStreamMag(const Command* cmd);
+
+void cmdSetLcd(const Command* cmd) {
+    if (cmd->type == CMD_VALUE_STRING)
+        lcd.printf("%4s", cmd->str);
+    else
+        lcdPrintInt<4,' '>("", commandValue(cmd), "");
+}
+
+// Target specific commands, keep sorted by name. Each target block
+// defines its own table, handleCMD() and sendHelp() use the one built.
+const CommandEntry targetCommands[] = {
+    { COMMAND('S','E','T','L','C','D'), CMD_ARG_INT | CMD_ARG_STRING, cmdSetLcd,
+      "Set LCD string, e.g. send {'SETLCD':'1234'}" },
+    { COMMAND('S','T','R','L','G','T'), CMD_ARG_INT, cmdStreamLight,
+      "Stream light sensor values ({'STRLGT':x}, x = 0(off) or 1(on))" },
+    { COMMAND('S','T','R','M','A','G'), CMD_ARG_INT, cmdStreamMag,
+      "Stream magnetometer values ({'STRMAG':x}, x = 0(off) or 1(on))" },
+};
+
+#define SENSORS_AVAILABLE (STREAM_FRAME_TOUCH | STREAM_FRAME_ACC | STREAM_FRAME_MAG | STREAM_FRAME_LIGHT)
+#endif
+
+#if defined(TARGET_KL25Z)
+PwmOut rled(LED_RED);
+PwmOut gled(LED_GREEN);
+PwmOut bled(LED_BLUE);
+
+void setRGB(uint8_t r, uint8_t g, uint8_t b) {
+    rled = 1.0 - ((float)r/255.0f);
+    gled = 1.0 - ((float)g/255.0f);
+    bled = 1.0 - ((float)b/255.0f);
+}
+
+void cmdSetRgb(const Command* cmd) {
+    if (cmd->valueCount != 3) {
+        commandStatus = CMD_INVALID;
+        return;
+    }
+    setRGB(cmd->values[0], cmd->values[1], cmd->values[2]);
+}
+
+// Target specific commands, keep sorted by name. Each target block
+// defines its own table, handleCMD() and sendHelp() use the one built.
+const CommandEntry targetCommands[] = {
+    { COMMAND('S','E','T','R','G','B'), CMD_ARG_ARRAY, cmdSetRgb,
+      "Set LED RGB color, e.g. send {'SETRGB':[255,0,0]}" },
+};
+
+#define SENSORS_AVAILABLE (STREAM_FRAME_TOUCH | STREAM_FRAME_ACC)
+#endif
+
+// Instrumentation, reported by GETSTS and cleared by RSTSTS
+ErrorHistogram tickErrors;   // Sample clock tick interval minus the nominal period, us
+TimeStat accReadTime;        // us reading the accelerometer, per tick
+TimeStat parseTime;          // Cycles in the command parser, per received packet
+TimeStat commandTime;        // us from reading a packet to its replies staged
+TimeStat logTextTime;        // us per GETLOG download, command to last line
+TimeStat logBinaryTime;      // us per GETBIN download, command to last chunk
+uint32_t statsStart = 0;     // us_ticker time of the last reset
+uint32_t statsSamples = 0;   // Accelerometer samples read
+uint32_t statsOverruns = 0;  // Samples dropped because the ring was full
+uint32_t statsDropped = 0;   // Oldest samples dropped because the host fell behind
+uint32_t statsHeld = 0;      // Readings not sent because they were inside their dead band
+uint32_t statsFifoOverflows = 0;
+uint32_t statsRxPeak = 0;    // Largest read into rbuf
+uint32_t lastTick = 0;
+bool lastTickValid = false;
+uint32_t tickPeriodUs = SAMPLING_WAIT_US;  // Nominal interval of the running sample or log clock
+
+// Called first thing in each sample or log clock tick
+void recordTick(uint32_t now) {
+    if (lastTickValid)
+        tickErrors.add(now - lastTick - tickPeriodUs);
+    lastTick = now;
+    lastTickValid = true;
+}
+
+// Sampling engine
+// The sample clock ISR reads the sensors on schedule and pushes the
+// samples to the ring, the main loop only drains and encodes them. This
+// keeps the sampling interval independent of USB and command handling
+// load. Every sample carries its sequence number and us_ticker time.
+// Each sensor has its own rate, see SensorScheduler; a frame holds the
+// sensors due on its tick.
+#define SAMPLE_RING_SIZE 64  // Must hold at least one full FIFO drain
+#define SESSION_COUNT 2      // WebUSB and CDC, see Session
+
+SampleRing<StreamFrame, SAMPLE_RING_SIZE, SESSION_COUNT> sampleRing;  // One reader per session
+SampleClock sampleClock;
+SensorScheduler sensorScheduler;  // What the sampler reads, and how often
+bool samplerRunning = false;
+
+// Optional decimation between the accelerometer and the stream and log
+// sinks: the sensor is read factor times faster and low-pass filtered
+// down to _stream_sampling_rate, so the host gets fewer, unaliased
+// samples. Timestamps stay those of the newest input sample.
+CicDecimator accFilter;
+uint32_t frameRates[STREAM_SENSOR_COUNT];  // How often each sensor arrives in the sample ring
+
+void readSensor(int sensor, StreamFrame& frame) {
+    switch (sensor) {
+        case STREAM_SENSOR_TOUCH:
+            frame.touch = tsi.readDistance();
+            break;
+        case STREAM_SENSOR_ACC: {
+            int16_t xyz[3];
+            uint32_t start = us_ticker_read();
+            acc.getAccAllAxis(xyz);
+            accReadTime.add(us_ticker_read() - start);
+            statsSamples++;
+            if (!accFilter.push(xyz, frame.acc))
+                return;  // Filter input only
+            break;
+        }
+#if defined(TARGET_KL46Z)
+        case STREAM_SENSOR_MAG:
+            mag.getMagAllAxis(frame.mag);
+            break;
+        case STREAM_SENSOR_LIGHT:
+            frame.light = lightSensor.read_u16();
+            break;
+#endif
+    }
+    frame.mask |= 1 << sensor;
+}
+
+// Read the sensors in due into frame, fastest first
+void readDueSensors(uint8_t due, StreamFrame& frame) {
+    for (int i=0; due; i++) {
+        int sensor = sensorScheduler.byPriority(i);
+        if (due & (1 << sensor)) {
+            readSensor(sensor, frame);
+            due &= ~(1 << sensor);
+        }
+    }
+}
+
+bool accFifoSampling() {
+    return accHighRate && (sensorScheduler.enabled() & STREAM_FRAME_ACC);
+}
+
+// High-rate variant: the accelerometer FIFO did the sampling, so pop it
+// in one burst and reconstruct the sample times from the data rate.
+// The accelerometer sets the tick rate, so it is due on every sample;
+// the slower sensors due during the burst are read once, into its
+// last frame.
+void sampleFifoISR() {
+    StreamFrame frame;
+    int16_t xyz[MMA8451Q_FIFO_DEPTH*3];
+    uint8_t input[MMA8451Q_FIFO_DEPTH];  // Input sample of each filter output
+    bool overflowed;
+    uint8_t due = 0;
+    int outputs = 0;
+
+    uint32_t now = us_ticker_read();
+    recordTick(now);
+    int count = accFifo.readFifo(xyz, MMA8451Q_FIFO_DEPTH, &overflowed);
+    accReadTime.add(us_ticker_read() - now);
+    statsSamples += count;
+    if (overflowed) {
+        accFifoOverflows++;
+        statsFifoOverflows++;
+    }
+
+    for (int i=0; i<count; i++) {
+        due |= sensorScheduler.tick();
+        if (accFilter.push(&xyz[i*3], &xyz[outputs*3]))
+            input[outputs++] = i;
+    }
+    due &= ~STREAM_FRAME_ACC;
+    for (int i=0; i<outputs; i++) {
+        frame.mask = STREAM_FRAME_ACC;
+        frame.timestamp = now - (count-1-input[i])*accSamplingWaitUs;
+        frame.seq = streamSequence++;
+        frame.acc[0] = xyz[i*3];
+        frame.acc[1] = xyz[i*3+1];
+        frame.acc[2] = xyz[i*3+2];
+        if (i == outputs-1)
+            readDueSensors(due, frame);
+        if (!sampleRing.push(frame))
+            statsOverruns++;
+    }
+    if (outputs == 0 && due) {
+        frame.mask = 0;
+        frame.timestamp = now;
+        frame.seq = streamSequence++;
+        readDueSensors(due, frame);
+        if (!sampleRing.push(frame))
+            statsOverruns++;
+    }
+}
+
+void sampleISR() {
+    StreamFrame frame;
+
+    if (accFifoSampling()) {
+        sampleFifoISR();
+        return;
+    }
+
+    frame.timestamp = us_ticker_read();
+    recordTick(frame.timestamp);
+    frame.mask = 0;
+    readDueSensors(sensorScheduler.tick(), frame);
+    if (!frame.mask)
+        return;  // Only fed the filter
+    frame.seq = streamSequence++;  // Keeps counting on overrun, so the host sees the gap
+    if (!sampleRing.push(frame))
+        statsOverruns++;
+}
+
+void startSampler() {
+    // The clock ticks at the fastest sensor's rate. In high-rate mode it
+    // only has to keep up with the FIFO watermark.
+    uint32_t samples = accFifoSampling() ? ACC_FIFO_WATERMARK : 1;
+
+    sampleClock.detach();
+    sensorScheduler.restart();
+    accFilter.reset();
+    tickPeriodUs = samples * 1000000 / sensorScheduler.tickRate();
+    sampleClock.attach(&sampleISR, sensorScheduler.tickRate(), samples);
+    lastTickValid = false;
+    samplerRunning = true;
+}
+
+void stopSampler() {
+    sampleClock.detach();
+    samplerRunning = false;
+}
+
+// Compressed one-shot log, stored in the accLog memory
+DeltaLog accDeltaLog;
+bool accLogCompressed = false;  // Current log content is delta compressed
+
+// One-shot logging
+// After the countdown the log clock records from the start of accLog
+// until the log is full or the recording is stopped.
+bool logRecording = false;      // Countdown or one-shot recording in progress
+volatile int logRecorded = 0;   // Samples stored by the current recording
+uint32_t logGeneration = 0;     // Bumped when a log is requested or cancelled, ends TAILOG
+
+// One-shot log sink, stores raw into accLog or through the delta
+// compressor. Returns how many of the count samples fit.
+int storeLogSamples(const int16_t* xyz, int count) {
+    int stored = 0;
+
+    if (accLogCompressed) {
+        while (stored < count && accDeltaLog.append(&xyz[stored*3]))
+            stored++;
+    } else {
+        stored = MIN(count, (&accLog[accLogSize] - accLogPtr) / 3);
+        memcpy(accLogPtr, xyz, stored*3*sizeof(int16_t));
+        accLogPtr += stored*3;
+    }
+    return stored;
+}
+
+// Pre-trigger logging
+// While armed, accLog is written continuously as a ring. The trigger
+// starts a countdown of post-trigger samples, after which the ring is
+// frozen holding the pre-trigger samples followed by the post-trigger ones.
+SampleClock logClock;
+bool logArmed = false;
+bool motionArmed = false;           // A motion trigger is waiting on INT1, see motionISR()
+volatile int logHead = 0;           // Next sample slot in accLog
+volatile int logFilled = 0;         // Samples written, saturates at accLogLength
+volatile int logPostRemaining = 0;  // Post-trigger samples still to record, 0 before the trigger
+volatile bool logFrozen = false;
+int logTriggerFilled = 0;           // Samples already in the ring when the trigger came
+volatile uint32_t logLastTimestamp = 0;  // us_ticker time of the newest logged sample
+
+// Duration of n sample periods of the current log, exact to the microsecond
+uint32_t samplesToUs(uint32_t n) {
+    return (uint32_t)(((uint64_t)n * 1000000) / accLogRate);
+}
+
+// Back from the newest sample to the time of the first of count samples
+void setLogTimestamp(int count) {
+    accLogTimestamp = logLastTimestamp - (count > 0 ? samplesToUs(count-1) : 0);
+}
+
+void logSamples(const int16_t* xyz, int count) {
+    for (int i=0; i<count && !logFrozen; i++) {
+        int16_t* slot = &accLog[logHead*3];
+        slot[0] = xyz[i*3];
+        slot[1] = xyz[i*3+1];
+        slot[2] = xyz[i*3+2];
+        logHead = (logHead+1 < accLogLength) ? logHead+1 : 0;
+        if (logFilled < accLogLength)
+            logFilled++;
+        if (logPostRemaining > 0 && --logPostRemaining == 0)
+            logFrozen = true;
+    }
+}
+
+// Run count samples through accFilter in place. Returns the number of
+// output samples, last is set to the input index of the newest one.
+int filterSamples(int16_t* xyz, int count, int* last) {
+    int outputs = 0;
+
+    for (int i=0; i<count; i++) {
+        if (accFilter.push(&xyz[i*3], &xyz[outputs*3])) {
+            outputs++;
+            *last = i;
+        }
+    }
+    return outputs;
+}
+
+// Log clock, feeds the pre-trigger ring while armed and the one-shot
+// log otherwise
+void logISR() {
+    int16_t xyz[MMA8451Q_FIFO_DEPTH*3];
+    int count = 1;
+    int last = 0;
+    bool overflowed;
+    uint32_t now = us_ticker_read();
+
+    recordTick(now);
+    if (accHighRate) {
+        count = accFifo.readFifo(xyz, MMA8451Q_FIFO_DEPTH, &overflowed);
+        if (overflowed) {
+            accFifoOverflows++;
+            statsFifoOverflows++;
+        }
+    } else {
+        acc.getAccAllAxis(xyz);
+    }
+    uint32_t readDone = us_ticker_read();
+    accReadTime.add(readDone - now);
+    statsSamples += count;
+    int outputs = filterSamples(xyz, count, &last);
+    if (outputs)
+        logLastTimestamp = readDone - (count-1-last)*accSamplingWaitUs;
+    count = outputs;
+    if (logArmed) {
+        logSamples(xyz, count);
+    } else {
+        int stored = storeLogSamples(xyz, count);
+        logRecorded += stored;
+        if (stored < count)
+            logFrozen = true;  // log is full
+    }
+    if (logFrozen)
+        logClock.detach();
+}
+
+bool logClockRunning() {
+    return (logArmed || currentState == ACC_LOGGING_STATE) && !logFrozen;
+}
+
+void startLogClock() {
+    logClock.detach();
+    accFilter.reset();
+    tickPeriodUs = accSamplingWaitUs * (accHighRate ? ACC_FIFO_WATERMARK : 1);
+    logClock.attach(&logISR, accSamplingRate, accHighRate ? ACC_FIFO_WATERMARK : 1);
+    lastTickValid = false;
+}
+
+void armLog() {
+    logClock.detach();
+    logHead = 0;
+    logFilled = 0;
+    logPostRemaining = 0;
+    logFrozen = false;
+    accLoggedDataLength = 0;  // accLog is being overwritten from now on
+    accLogStart = 0;
+    accLogCompressed = false;  // The ring needs fixed-size slots
+    if (accHighRate)
+        accFifo.flush();
+    startLogClock();
+    logArmed = true;
+}
+
+void triggerLog() {
+    __disable_irq();
+    logPostRemaining = accLogLength - _acc_log_pretrigger;
+    logTriggerFilled = logFilled;
+    __enable_irq();
+}
+
+void disarmLog() {
+    logClock.detach();
+    logArmed = false;
+}
+
+// Keep the trigger and filter settings with the log they describe
+void setLogSettings() {
+    accLogTrigger = _acc_log_trigger;
+    accLogThreshold = MMA8451QMotion::programmedMg(_acc_log_threshold);
+    accLogCount = _acc_log_count;
+    accLogDecimation = accFilter.factor();
+    accLogRate = _stream_sampling_rate;
+}
+
+// Publish the frozen ring to GETLOG, oldest sample first
+void finishLog() {
+    disarmLog();
+    accLogStart = (logFilled < accLogLength) ? 0 : logHead;
+    accLoggedDataLength = logFilled*3;
+    accLogPretrigger = MIN(logTriggerFilled, _acc_log_pretrigger);
+    setLogSettings();
+    setLogTimestamp(logFilled);
+}
+
+void setLogPretrigger(int samples) {
+    if (samples < 0 || samples >= accLogLength) {
+        commandStatus = CMD_INVALID;
+        return;
+    }
+
+    _acc_log_pretrigger = samples;
+}
+
+// Rates the accelerometer can be read at
+bool isValidAccRate(int rate) {
+    return rate >= 1 && (rate <= MAX_SAMPLING_RATE || MMA8451QFifo::isValidRate(rate));
+}
+
+bool isValidSamplingRate(int rate) {
+    return rate >= 1 && isValidAccRate(rate * accFilter.factor());
+}
+
+void setStreamSamplingRate(int rate) {
+    if (!isValidSamplingRate(rate))
+        return;
+
+    _stream_sampling_rate = rate;
+    accSamplingRate = rate * accFilter.factor();
+    accSamplingWaitUs = 1000000 / accSamplingRate;
+
+    // The clock ISRs read the accelerometer on the same I2C bus, so both
+    // are stopped while it changes mode and re-attached below
+    sampleClock.detach();
+    logClock.detach();
+    if (accSamplingRate > MAX_SAMPLING_RATE) {
+        accFifo.enable(accSamplingRate, ACC_FIFO_WATERMARK);
+        accHighRate = true;
+    } else if (accHighRate) {
+        accFifo.disable();
+        accHighRate = false;
+    }
+    if (samplerRunning && sensorScheduler.enabled())
+        startSampler();  // re-attach with the new period
+    if (logClockRunning())
+        startLogClock();
+}
+
+// Communication
+// VID/PID assigned here: https://github.com/pidcodes/pidcodes.github.com/blob/master/1209/D017/index.md
+WebUSBCDC webUSB(0x1209, 0xD017, 0x0001, true);
+
+// Host sessions
+// The WebUSB and CDC interfaces are served side by side. Each has its own
+// command parser, output and stream subscriptions, and reads the shared
+// sample ring at its own pace. The sampler reads each sensor at the
+// highest rate a session asked for; slower sessions skip samples to get
+// theirs.
+struct Session {
+    Session(bool cdc) : isCDC(cdc), connected(false), out(webUSB, cdc), rbuf(0) {
+        reset();
+    }
+
+    // Back to the settings of a freshly connected host
+    void reset() {
+        sensors = 0;
+        for (int i=0; i<STREAM_SENSOR_COUNT; i++) {
+            sensorRate[i] = 0;
+            rates[i] = 0;
+            phase[i] = 0;
+            deadband[i] = 0;
+        }
+        deadbandSensors = 0;
+        keyframeUs = DEFAULT_KEYFRAME_MS*1000;
+        binaryStreaming = 0;
+        sendNotifications = 0;
+        samplingRate = DEFAULT_SAMPLING_RATE;
+        batchSize = DEFAULT_BATCH_SIZE;
+        dropOldest = 0;
+        streaming = false;
+        batchSamples = 0;
+        batchStart = 0;
+        reportedOverruns = 0;
+        tailing = false;
+        parser.reset();
+    }
+
+    bool isCDC;
+    bool connected;
+    PacketWriter out;        // All output to the host is staged in full bulk packets
+    CommandParser parser;
+    uint8_t* rbuf;           // MAX_PACKET_SIZE_EPBULK bytes from the memory arena
+
+    uint8_t sensors;         // STREAM_FRAME_* bits of the sensors it streams
+    uint32_t sensorRate[STREAM_SENSOR_COUNT];  // SENRTE rates, 0 follows samplingRate
+    int binaryStreaming;     // 0: JSON StreamData text, 1: StreamFrame binary
+    int sendNotifications;
+    int samplingRate;        // Accelerometer rate, and the default for the other sensors
+    int batchSize;
+    int dropOldest;          // Backpressure: 0 keeps the queued samples and drops new ones,
+                             // 1 drops the oldest to stay current
+
+    bool streaming;          // Attached to the sample ring
+    int batchSamples;
+    uint32_t batchStart;     // us_ticker time the batch was started
+    uint32_t rates[STREAM_SENSOR_COUNT];  // What it gets of each sensor, 0 if not streamed
+    uint32_t phase[STREAM_SENSOR_COUNT];  // For sensors slower than the sampler reads them
+    uint32_t reportedOverruns;
+
+    uint16_t deadband[STREAM_SENSOR_COUNT];  // SETDBD change needed to send a reading, 0 sends all
+    uint8_t deadbandSensors; // STREAM_FRAME_* bits of the sensors with a dead band
+    uint32_t keyframeUs;     // SETKEY interval, 0 for no keyframes
+    uint8_t held;            // STREAM_FRAME_* bits of the sensors the host holds a value of
+    int32_t heldValue[STREAM_SENSOR_COUNT][3];  // Last value sent of each dead-banded sensor
+    uint32_t keyframeTime;   // Sample timestamp of the last keyframe
+
+    bool tailing;            // Following the log with TAILOG
+    uint32_t tailNext;       // Next log sample index to send
+    uint32_t tailSent;       // us_ticker time of the last tail chunk
+    uint32_t tailLog;        // logGeneration of the log it follows
+};
+
+Session webSession(false);
+Session cdcSession(true);
+Session* const sessions[SESSION_COUNT] = { &webSession, &cdcSession };
+Session* session = &webSession;  // Where command replies go
+Session* logSession = 0;         // Where the last LOGACC came from, its rate paces the log
+
+// Send a complete message
+void sendString(const char* str) {
+    session->out.print(str);
+    session->out.flush();
+}
+
+// Send a notification to every session that asked for them
+void notifyAll(const char* str) {
+    for (int i=0; i<SESSION_COUNT; i++) {
+        if (sessions[i]->connected && sessions[i]->sendNotifications) {
+            sessions[i]->out.print(str);
+            sessions[i]->out.flush();
+        }
+    }
+}
+
+// Stream batching - samples are packed into full bulk packets and only
+// flushed when the batch is complete or the oldest sample gets too old.
+void flushStreamBatch(Session& s) {
+    s.out.flush();
+    s.batchSamples = 0;
+}
+
+void printStreamFrame(PacketWriter& out, const StreamFrame* frame, int rate) {
+    out.print("{\"datatype\":\"StreamData\",\n\"samplingrate\":");
+    out.printInt(rate);
+    out.print(",\n\"seq\":");
+    out.printInt(frame->seq);
+    out.print(",\n\"timestamp\":");
+    out.printUInt(frame->timestamp);
+    if (frame->mask & STREAM_FRAME_KEY)
+        out.print(",\n\"keyframe\":1");
+    if (frame->mask & STREAM_FRAME_TOUCH) {
+        out.print(",\n\"touchsensordata\":");
+        out.printInt(frame->touch);
+    }
+    if (frame->mask & STREAM_FRAME_ACC) {
+        out.print(",\n\"accelerometerdata\":[");
+        out.printInt(frame->acc[0]);
+        out.print(",");
+        out.printInt(frame->acc[1]);
+        out.print(",");
+        out.printInt(frame->acc[2]);
+        out.print("]");
+    }
+    if (frame->mask & STREAM_FRAME_MAG) {
+        out.print(",\n\"magnetometerdata\":[");
+        out.printInt(frame->mag[0]);
+        out.print(",");
+        out.printInt(frame->mag[1]);
+        out.print(",");
+        out.printInt(frame->mag[2]);
+        out.print("]");
+    }
+    if (frame->mask & STREAM_FRAME_LIGHT) {
+        out.print(",\n\"lightsensordata\":");
+        out.printInt(frame->light);
+    }
+    out.print("\n}");
+}
+
+// One "[x,y,z]" line of the GETLOG dump
+void printLogLine(PacketWriter& out, const int16_t* sample, bool last) {
+    out.print("[");
+    out.printInt(sample[0]);
+    out.print(",");
+    out.printInt(sample[1]);
+    out.print(",");
+    out.printInt(sample[2]);
+    out.print(last ? "]\n" : "],\n");
+}
+
+// Encode the sensors in mask of a sample for one session
+void streamSample(Session& s, const StreamFrame* sample, uint8_t mask) {
+    StreamFrame frame = *sample;
+
+    frame.mask = mask;
+    if (s.batchSamples == 0)
+        s.batchStart = us_ticker_read();
+
+    if (s.binaryStreaming) {
+        uint8_t fbuf[STREAM_FRAME_MAX_SIZE];
+        s.out.write(fbuf, encodeStreamFrame(&frame, fbuf));
+    } else {
+        printStreamFrame(s.out, &frame, s.samplingRate);
+    }
+
+    if (++s.batchSamples >= s.batchSize)
+        flushStreamBatch(s);
+}
+
+// Readings of one sensor in a frame, touch and light have a single value
+int sensorValues(const StreamFrame* frame, int sensor, int32_t* v) {
+    switch (sensor) {
+        case STREAM_SENSOR_TOUCH:
+            v[0] = frame->touch;
+            return 1;
+        case STREAM_SENSOR_ACC:
+            v[0] = frame->acc[0];
+            v[1] = frame->acc[1];
+            v[2] = frame->acc[2];
+            return 3;
+        case STREAM_SENSOR_MAG:
+            v[0] = frame->mag[0];
+            v[1] = frame->mag[1];
+            v[2] = frame->mag[2];
+            return 3;
+        default:
+            v[0] = frame->light;
+            return 1;
+    }
+}
+
+void setSensorValues(StreamFrame* frame, int sensor, const int32_t* v) {
+    switch (sensor) {
+        case STREAM_SENSOR_TOUCH:
+            frame->touch = v[0];
+            break;
+        case STREAM_SENSOR_ACC:
+            frame->acc[0] = v[0];
+            frame->acc[1] = v[1];
+            frame->acc[2] = v[2];
+            break;
+        case STREAM_SENSOR_MAG:
+            frame->mag[0] = v[0];
+            frame->mag[1] = v[1];
+            frame->mag[2] = v[2];
+            break;
+        default:
+            frame->light = v[0];
+            break;
+    }
+}
+
+// Change-driven streaming: drop the readings in mask that stay inside
+// their dead band of the value the host holds. Once per keyframe interval
+// every held sensor goes out, with the held value if it was not read this
+// tick, and the frame is marked STREAM_FRAME_KEY. Returns the mask to send.
+uint8_t applyDeadband(Session& s, StreamFrame* frame, uint8_t mask) {
+    bool key = s.keyframeUs && frame->timestamp - s.keyframeTime >= s.keyframeUs;
+    uint8_t send = mask & ~s.deadbandSensors;
+
+    for (int i=0; i<STREAM_SENSOR_COUNT; i++) {
+        uint8_t bit = 1 << i;
+        if (!(s.deadbandSensors & bit))
+            continue;
+        if (mask & bit) {
+            int32_t v[3];
+            int n = sensorValues(frame, i, v);
+            bool moved = key || !(s.held & bit);
+            for (int j=0; j<n && !moved; j++) {
+                int32_t d = v[j] - s.heldValue[i][j];
+                moved = d > s.deadband[i] || -d > s.deadband[i];
+            }
+            if (!moved) {
+                statsHeld++;
+                continue;
+            }
+            for (int j=0; j<n; j++)
+                s.heldValue[i][j] = v[j];
+            s.held |= bit;
+            send |= bit;
+        } else if (key && (s.held & bit) && s.rates[i]) {
+            setSensorValues(frame, i, s.heldValue[i]);
+            send |= bit;
+        }
+    }
+    if (key && (send & s.deadbandSensors)) {
+        send |= STREAM_FRAME_KEY;
+        s.keyframeTime = frame->timestamp;
+    }
+    return send;
+}
+
+// Longest JSON StreamData message, measured at boot
+uint32_t streamJsonMaxSize = 0;
+
+// Format a frame of every sensor with each number at its widest into a
+// discarding writer, so the size follows printStreamFrame
+void measureStreamJson() {
+    PacketWriter sizeOut(webUSB, false, true);
+    StreamFrame frame;
+
+    frame.mask = SENSORS_AVAILABLE | STREAM_FRAME_KEY;
+    frame.seq = 0xFFFF;
+    frame.timestamp = 0xFFFFFFFF;
+    frame.touch = -32768;
+    for (int i=0; i<3; i++) {
+        frame.acc[i] = -32768;
+        frame.mag[i] = -32768;
+    }
+    frame.light = 0xFFFF;
+    printStreamFrame(sizeOut, &frame, 99999);  // Wider than any rate
+    streamJsonMaxSize = sizeOut.bytesWritten();
+}
+
+// Free TX queue packets needed before a sample is encoded: the packets
+// the staged bytes plus the longest message fill, the last one sent by
+// the batch flush. A message is never cut by a full queue.
+uint32_t streamTxReserve(const Session& s) {
+    uint32_t size = s.binaryStreaming ? STREAM_FRAME_MAX_SIZE : streamJsonMaxSize;
+    return (s.out.pending() + size + MAX_PACKET_SIZE_EPBULK - 1) / MAX_PACKET_SIZE_EPBULK;
+}
+
+// Returns true if samples were left queued because the host is behind
+bool drainSamples(Session& s, int reader) {
+    const StreamFrame* frame;
+    bool hostBehind = false;
+
+    while ((frame = sampleRing.peek(reader)) != 0) {
+        if (webUSB.txFree(s.isCDC) < streamTxReserve(s)) {
+            // Dropping newest just leaves the ring to fill up and overrun
+            hostBehind = true;
+            if (s.dropOldest) {
+                while (sampleRing.count(reader) > SAMPLE_RING_SIZE/2) {
+                    sampleRing.advance(reader);
+                    statsDropped++;
+                }
+            }
+            break;
+        }
+        // Keep rates[i] out of every frameRates[i] readings of
+        // each sensor, frames with nothing left are skipped
+        uint8_t mask = 0;
+        for (int i=0; i<STREAM_SENSOR_COUNT; i++) {
+            if (!s.rates[i] || !(frame->mask & (1 << i)))
+                continue;
+            s.phase[i] += s.rates[i];
+            if (s.phase[i] >= frameRates[i]) {
+                s.phase[i] -= frameRates[i];
+                mask |= 1 << i;
+            }
+        }
+        if (mask & s.deadbandSensors) {
+            StreamFrame held = *frame;
+            mask = applyDeadband(s, &held, mask);
+            if (mask)
+                streamSample(s, &held, mask);
+        } else if (mask) {
+            streamSample(s, frame, mask);
+        }
+        sampleRing.advance(reader);
+    }
+
+    // Flush now if waiting for the next sample would exceed the latency bound
+    if (s.out.pending() && us_ticker_read() - s.batchStart + tickPeriodUs >= BATCH_MAX_LATENCY_US)
+        flushStreamBatch(s);
+
+    if (sampleRing.overrunCount() + accFifoOverflows != s.reportedOverruns) {
+        s.reportedOverruns = sampleRing.overrunCount() + accFifoOverflows;
+        if (s.sendNotifications) {
+            s.out.print("{\"datatype\":\"Notification\",\"data\":\"SampleOverrun\",\"overruns\":");
+            s.out.printInt(s.reportedOverruns);
+            s.out.print("}\n");
+            s.out.flush();
+        }
+    }
+    return hostBehind;
+}
+
+// Keep a session's sample ring reader attached while it streams
+void updateStreams() {
+    for (int i=0; i<SESSION_COUNT; i++) {
+        Session& s = *sessions[i];
+        bool wanted = s.connected && s.sensors;
+
+        if (wanted && !s.streaming) {
+            sampleRing.attach(i);
+            for (int j=0; j<STREAM_SENSOR_COUNT; j++)
+                s.phase[j] = frameRates[j] - s.rates[j];  // first reading goes out
+            s.held = 0;
+            s.keyframeTime = us_ticker_read();
+            s.reportedOverruns = sampleRing.overrunCount() + accFifoOverflows;
+        } else if (!wanted && s.streaming) {
+            sampleRing.detach(i);
+            flushStreamBatch(s);
+        }
+        s.streaming = wanted;
+    }
+}
+
+const uint32_t sensorMaxRate[STREAM_SENSOR_COUNT] = { TOUCH_MAX_RATE, 0, MAG_MAX_RATE, LIGHT_MAX_RATE };
+
+// Rate a session gets sensor at, 0 if it does not stream it
+uint32_t sessionRate(const Session& s, int sensor) {
+    if (!(s.sensors & (1 << sensor)))
+        return 0;
+    if (sensor == STREAM_SENSOR_ACC)
+        return s.samplingRate;
+    if (s.sensorRate[sensor])
+        return s.sensorRate[sensor];
+    return MIN((uint32_t)s.samplingRate, sensorMaxRate[sensor]);
+}
+
+#if defined(TARGET_KL46Z)
+bool magPresent = true;   // Cleared when the MAG3110 does not answer
+bool magEnabled = false;
+
+// Power the magnetometer up or down to match the streams. The clock ISRs
+// read the accelerometer on the same I2C bus: the sampler is detached
+// around it, the caller re-attaches it, and while the log clock runs the
+// change waits, the sampler is stopped then anyway. So does it while a
+// motion trigger is armed, as motionISR() reads the accelerometer too.
+// Returns true if the sampler was detached.
+bool updateMag(bool wanted) {
+    if (wanted == magEnabled || logClockRunning() || motionArmed)
+        return false;
+
+    sampleClock.detach();
+    if (!wanted) {
+        mag.disable();
+        magEnabled = false;
+        return true;
+    }
+    magEnabled = mag.enable();
+    if (magEnabled)
+        return true;
+
+    // Nothing answered, stop streaming zeros
+    magPresent = false;
+    for (int i=0; i<SESSION_COUNT; i++) {
+        Session& s = *sessions[i];
+        if (!(s.sensors & STREAM_FRAME_MAG))
+            continue;
+        s.sensors &= ~STREAM_FRAME_MAG;
+        s.rates[STREAM_SENSOR_MAG] = 0;
+        if (s.connected) {
+            s.out.print("{\"datatype\":\"StatusMessage\",\"data\":\"No magnetometer.\"}\n");
+            s.out.flush();
+        }
+    }
+    return true;
+}
+#endif
+
+// The sampler reads every sensor a session streams, at the highest rate
+// a connected session asked for. The accelerometer rate also paces the
+// log: a log waiting for its touch start follows the rate of the session
+// that asked for it, and a log clock that is running keeps its rate.
+// With decimation the accelerometer itself is read faster than its
+// samples arrive.
+void updateSampler() {
+    uint32_t rates[STREAM_SENSOR_COUNT] = { 0 };
+    int rate = 0;
+    bool changed = false;
+
+    for (int i=0; i<SESSION_COUNT; i++) {
+        Session& s = *sessions[i];
+        for (int j=0; j<STREAM_SENSOR_COUNT; j++)
+            s.rates[j] = sessionRate(s, j);
+        if (!s.connected)
+            continue;
+        for (int j=0; j<STREAM_SENSOR_COUNT; j++)
+            rates[j] = MAX(rates[j], s.rates[j]);
+        rate = MAX(rate, s.samplingRate);
+    }
+    if (logRecording || logArmed)
+        rate = _stream_sampling_rate;
+    else if (logSession && currentState == LOG_ACC_STATE)
+        rate = logSession->samplingRate;
+    if (rates[STREAM_SENSOR_ACC])
+        rates[STREAM_SENSOR_ACC] = rate;
+#if defined(TARGET_KL46Z)
+    if (updateMag(rates[STREAM_SENSOR_MAG] != 0)) {
+        changed = true;  // Re-attach the sampler below
+        if (!magEnabled)
+            rates[STREAM_SENSOR_MAG] = 0;
+    }
+#endif
+
+    for (int j=0; j<STREAM_SENSOR_COUNT; j++) {
+        frameRates[j] = rates[j];
+        if (j == STREAM_SENSOR_ACC)
+            rates[j] *= accFilter.factor();
+        if (rates[j] != sensorScheduler.rate(j))
+            changed = true;
+    }
+    if (changed) {
+        __disable_irq();  // The sample clock ticks the scheduler
+        for (int j=0; j<STREAM_SENSOR_COUNT; j++)
+            sensorScheduler.setRate(j, rates[j]);
+        __enable_irq();
+    }
+    if (rate && rate != _stream_sampling_rate)
+        setStreamSamplingRate(rate);
+    else if (changed && samplerRunning && sensorScheduler.enabled())
+        startSampler();  // re-attach at the new tick rate
+}
+
+// Logging tasks
+// The countdown and the recording progress in small steps from the main
+// loop, paced by timer, so commands are still served while logging.
+#define COUNTDOWN_STEPS 10      // Blinks before a one-shot recording starts
+#define COUNTDOWN_STEP_TICKS 5  // UI ticks per blink
+
+int countdownTicks = 0;
+
+// True once per UI tick
+bool uiTickDue() {
+    if (timer.read_ms() < UI_TICK_MS)
+        return false;
+    timer.reset();
+    return true;
+}
+
+void sendLogBusy() {
+    commandStatus = CMD_BUSY;
+    sendString("{\"datatype\":\"StatusMessage\",\"data\":\"Logging in progress.\"}\n");
+}
+
+void startCountdown() {
+    // The log clock will own the accelerometer
+    if (samplerRunning)
+        stopSampler();
+    logRecording = true;
+    countdownTicks = 0;
+#if defined(TARGET_KL25Z)
+    setRGB(255,0,0);
+#elif defined(TARGET_KL46Z)
+    lcd.printf("ACCR");
+#endif
+    currentState = ACC_READY_STATE;
+}
+
+// Start the one-shot log clock, also called from the motion trigger interrupt
+void beginRecording() {
+    accLogPtr = accLog; // Point at the beginning
+    accLogStart = 0;
+    accLogPretrigger = 0;
+    setLogSettings();
+    accLogCompressed = _acc_log_compress;
+    if (accLogCompressed)
+        accDeltaLog.begin((uint8_t*)accLog, accLogSize*sizeof(int16_t));
+    logRecorded = 0;
+    logFrozen = false;
+    if (accHighRate)
+        accFifo.flush();  // drop samples queued during the countdown
+    startLogClock();
+}
+
+void recordingStarted() {
+    // Constant red LED to indicate recording
+    notifyAll("{\"datatype\":\"Notification\",\"data\":\"LoggingStarted\"}\n");
+#if defined(TARGET_KL25Z)
+    setRGB(255,0,0);
+#elif defined(TARGET_KL46Z)
+    lcd.printf("ACCR");
+    lcd.DP2(1);
+#endif
+    currentState = ACC_LOGGING_STATE;
+}
+
+void startRecording() {
+    recordingStarted();
+    beginRecording();
+}
+
+// The pre-trigger ring is now recording the post-trigger samples
+void logTriggered() {
+    notifyAll("{\"datatype\":\"Notification\",\"data\":\"LoggingStarted\"}\n");
+#if defined(TARGET_KL25Z)
+    setRGB(255,0,0);
+#elif defined(TARGET_KL46Z)
+    lcd.printf("ACCR");
+#endif
+    currentState = ACC_TRIGGERED_STATE;
+}
+
+// Motion trigger
+// Instead of a touch swipe and a countdown, the MMA8451Q watches for the
+// event itself and pulls INT1. Its interrupt triggers the pre-trigger log
+// or starts the one-shot recording with the first sample read right
+// there, and the main loop only catches up with the notification. While
+// waiting nothing is polled.
+const char* const triggerNames[] = { "touch", "transient", "freefall", "pulse" };
+
+volatile bool motionTriggered = false;
+
+void motionISR() {
+    accInt.disable_irq();  // INT1 stays low until cleared, once is enough
+    if (logArmed) {
+        triggerLog();
+    } else {
+        beginRecording();
+        logISR();
+    }
+    motionTriggered = true;
+}
+
+// Call before the log clock starts, the sensor is configured over I2C
+void armMotionTrigger() {
+    accMotion.enable(_acc_log_trigger, _acc_log_threshold, _acc_log_count);
+    accMotion.clear();
+    motionTriggered = false;
+    motionArmed = true;
+    accInt.fall(&motionISR);
+    accInt.enable_irq();
+#if defined(TARGET_KL25Z)
+    setRGB(0,0,64);
+#elif defined(TARGET_KL46Z)
+    lcd.printf("LACC");
+#endif
+}
+
+// Call with the log clock stopped
+void disarmMotionTrigger() {
+    if (!motionArmed)
+        return;
+    accInt.disable_irq();
+    accMotion.disable();
+    motionArmed = false;
+    motionTriggered = false;
+}
+
+// Catch up with a trigger the interrupt has already acted on
+void checkMotionTrigger() {
+    if (!motionTriggered)
+        return;
+    motionTriggered = false;
+    if (logArmed)
+        logTriggered();
+    else
+        recordingStarted();
+}
+
+// Blink red LED for 5s to indicate logging will start
+void stepCountdown() {
+    if (!uiTickDue() || ++countdownTicks % COUNTDOWN_STEP_TICKS)
+        return;
+
+    int step = countdownTicks / COUNTDOWN_STEP_TICKS - 1;
+#if defined(TARGET_KL25Z)
+    setRGB((step&1?0:255),0,0);
+#elif defined(TARGET_KL46Z)
+    lcdPrintInt<2,' '>("-", (COUNTDOWN_STEPS-step)>>1, "s");
+#endif
+    if (step == COUNTDOWN_STEPS-1)
+        startRecording();
+}
+
+void logEnded() {
+    disarmMotionTrigger();
+#if defined(TARGET_KL46Z)
+    lcd.printf("DONE");
+#endif
+    notifyAll("{\"datatype\":\"Notification\",\"data\":\"LoggingEnded\"}\n");
+    // Set green LED to indicate logging is done
+#if defined(TARGET_KL25Z)
+    setRGB(0,255,0);
+#endif
+    currentState = IDLE_STATE;
+}
+
+void stopRecording() {
+    logClock.detach();
+    logFrozen = true;
+    logRecording = false;
+    accLoggedDataLength = logRecorded*3;
+    setLogTimestamp(logRecorded);
+    if (accLogCompressed)
+        accDeltaLog.finish();
+#if defined(TARGET_KL46Z)
+    lcd.DP2(0);
+#endif
+    logEnded();
+}
+
+void stepRecording() {
+    if (logFrozen) {
+        stopRecording();
+        return;
+    }
+    // A swipe is much slower than a UI tick, so touch is only read once per tick
+    if (!uiTickDue())
+        return;
+    // Check if user swiped to stop logging (TODO: actual swipe detection ;))
+    if (tsi.readDistance() > 20) {
+        stopRecording();
+        return;
+    }
+#if defined(TARGET_KL46Z)
+    lcdPrintInt<3,' '>("", logRecorded*10/_stream_sampling_rate, "s");
+#endif
+}
+
+// Drop a log that is waiting for its countdown or trigger
+void cancelLog() {
+    logGeneration++;
+    if (logArmed)
+        disarmLog();
+    disarmMotionTrigger();
+    logRecording = false;
+#if defined(TARGET_KL25Z)
+    setRGB(0,255,0);
+#elif defined(TARGET_KL46Z)
+    lcd.printf("RDY ");
+#endif
+    currentState = IDLE_STATE;
+}
+
+void setStreamBatchSize(int size) {
+    if (size < 1 || size > MAX_BATCH_SIZE) {
+        commandStatus = CMD_INVALID;
+        return;
+    }
+
+    flushStreamBatch(*session);
+    session->batchSize = size;
+}
+
+void sendHardwareInformation() {
+
+    session->out.print("{\"datatype\":\"HardwareInfo\",\n");
+#if defined(TARGET_KL25Z)
+    session->out.print("\"devicetype\":\"empiriKit|MOTION\",\n");
+#elif defined(TARGET_KL46Z)
+    session->out.print("\"devicetype\":\"empiriKit|KL46Z\",\n");
+#endif
+    session->out.print("\"version\":\"");
+    session->out.print(versionString);
+    session->out.print("\",\n\"uid\":\"0x");
+    session->out.printHex(SIM->UIDMH, 4);  // Unique id, 0x40048058
+    session->out.printHex(SIM->UIDML, 8);
+    session->out.printHex(SIM->UIDL, 8);
+    session->out.print("\",\n\"logcapacity\":");
+    session->out.printInt(accLogLength);
+    session->out.print(",\n\"logseconds\":");
+    session->out.printInt(accLogLength / _stream_sampling_rate);
+    session->out.print(",\n");
+    session->out.print("\"capabilities\":[\n");
+    session->out.print("\"accelerometer\",\n");
+#if defined(TARGET_KL25Z)
+    session->out.print("\"rgbled\",\n");
+#elif defined(TARGET_KL46Z)
+    session->out.print("\"magnetometer\",\n");
+    session->out.print("\"lightsensor\",\n");
+    session->out.print("\"lcd4num\",\n");
+#endif
+    session->out.print("\"touchsensor\"\n");
+    sendString("]}");
+}
+
+void printTimeStat(const char* name, const TimeStat& stat) {
+    session->out.print(",\n\"");
+    session->out.print(name);
+    session->out.print("\":{\"count\":");
+    session->out.printUInt(stat.count);
+    session->out.print(",\"total\":");
+    session->out.printUInt(stat.total);
+    session->out.print(",\"max\":");
+    session->out.printUInt(stat.max);
+    session->out.print("}");
+}
+
+void sendStatus() {
+    session->out.print("{\"datatype\":\"Status\",\n\"elapsed\":");
+    session->out.printUInt(us_ticker_read() - statsStart);
+    session->out.print(",\n\"samplingrate\":");
+    session->out.printInt(_stream_sampling_rate);
+    session->out.print(",\n\"tickrate\":");
+    session->out.printUInt(sensorScheduler.tickRate());
+    session->out.print(",\n\"decimation\":");
+    session->out.printInt(accFilter.factor());
+    session->out.print(",\n\"samples\":");
+    session->out.printUInt(statsSamples);
+    session->out.print(",\n\"overruns\":");
+    session->out.printUInt(statsOverruns);
+    session->out.print(",\n\"dropped\":");
+    session->out.printUInt(statsDropped);
+    session->out.print(",\n\"held\":");
+    session->out.printUInt(statsHeld);
+    session->out.print(",\n\"fifooverflows\":");
+    session->out.printUInt(statsFifoOverflows);
+    session->out.print(",\n\"rxpeak\":");
+    session->out.printUInt(statsRxPeak);
+    session->out.print(",\n\"usbbytes\":");
+    session->out.printUInt(session->out.bytesWritten());
+    session->out.print(",\n\"usbpackets\":");
+    session->out.printUInt(session->out.packetsSent());
+    session->out.print(",\n\"usbdropped\":");
+    session->out.printUInt(webUSB.txDropped(session->isCDC));
+    // Times in us, except parsing in CPU cycles
+    printTimeStat("usbwrite", session->out.sendTime());
+    printTimeStat("accread", accReadTime);
+    printTimeStat("parse", parseTime);
+    printTimeStat("command", commandTime);
+    printTimeStat("getlog", logTextTime);
+    printTimeStat("getbin", logBinaryTime);
+    // Bin 0 is below 8 us, each further bin doubles
+    session->out.print(",\n\"tickerror\":{\"max\":");
+    session->out.printUInt(tickErrors.max);
+    session->out.print(",\"histogram\":[");
+    for (int i=0; i<STATS_ERROR_BINS; i++) {
+        if (i)
+            session->out.print(",");
+        session->out.printUInt(tickErrors.bins[i]);
+    }
+    sendString("]}}\n");
+}
+
+void resetStats() {
+    __disable_irq();
+    tickErrors.reset();
+    accReadTime.reset();
+    statsSamples = 0;
+    statsOverruns = 0;
+    statsDropped = 0;
+    statsFifoOverflows = 0;
+    __enable_irq();
+    statsHeld = 0;
+    parseTime.reset();
+    commandTime.reset();
+    logTextTime.reset();
+    logBinaryTime.reset();
+    statsRxPeak = 0;
+    for (int i=0; i<SESSION_COUNT; i++)
+        sessions[i]->out.resetStats();
+    webUSB.clearTxDropped();
+    statsStart = us_ticker_read();
+}
+
+void printLogSettings() {
+    session->out.print(",\n\"decimation\":");
+    session->out.printInt(accLogDecimation);
+    session->out.print(",\n\"trigger\":\"");
+    session->out.print(triggerNames[accLogTrigger]);
+    session->out.print("\"");
+    if (accLogTrigger) {
+        session->out.print(",\n\"threshold\":");
+        session->out.printInt(accLogThreshold);
+        session->out.print(",\n\"count\":");
+        session->out.printInt(accLogCount);
+    }
+}
+
+// Binary log download, see LogChunk.h
+uint32_t logRangeOffset = 0;
+uint32_t logRangeLength = 0;
 
-#if defined(TARGET_KL25Z)
-PwmOut rled(LED_RED);
-PwmOut gled(LED_GREEN);
-PwmOut bled(LED_BLUE);
+uint32_t sendLogBytes(const uint8_t* buf, uint32_t len, uint32_t crc) {
+    session->out.write(buf, len);
+    return crc32(crc, buf, len);
+}
 
-void setRGB(uint8_t r, uint8_t g, uint8_t b) {
-    rled = 1.0 - ((float)r/255.0f);
-    gled = 1.0 - ((float)g/255.0f);
-    bled = 1.0 - ((float)b/255.0f);
+uint32_t logBinChunk = 0;  // Next sample to send
+uint32_t logBinEnd = 0;
+
+void beginLogBinary() {
+    uint32_t total = accLoggedDataLength/3;
+    uint32_t first = MIN(logRangeOffset, total);
+    uint32_t end = (logRangeLength < total - first) ? first + logRangeLength : total;
+
+    session->out.print("{\"datatype\":\"AccelerometerLogBinary\",\n\"accelrange\":");
+    session->out.printInt(_accelerometerRange);
+    session->out.print(",\n\"accelfactor\":");
+    session->out.printInt(8192 / _accelerometerRange);
+    session->out.print(",\n\"samplingrate\":");
+    session->out.printInt(accLogRate);
+    session->out.print(",\n\"pretrigger\":");
+    session->out.printInt(accLogPretrigger);
+    printLogSettings();
+    session->out.print(",\n\"timestamp\":");
+    session->out.printUInt(accLogTimestamp);
+    session->out.print(",\n\"samples\":");
+    session->out.printInt(total);
+    session->out.print(",\n\"offset\":");
+    session->out.printInt(first);
+    session->out.print(",\n\"length\":");
+    session->out.printInt(end - first);
+    sendString("}\n");
+
+    if (accLogCompressed) {
+        int16_t xyz[3];
+        accDeltaLog.rewind();
+        for (uint32_t i=0; i<first; i++)
+            accDeltaLog.next(xyz);
+    }
+    logBinChunk = first;
+    logBinEnd = end;
 }
-#endif
 
-void setStreamSamplingRate(int rate) {
-    if (rate < 1 || rate > 100)
+// Raw samples first..first+count of an uncompressed log, straight from
+// accLog in two pieces if the range wraps around its end. Returns the CRC.
+uint32_t sendLogSamples(uint32_t first, uint32_t count) {
+    uint32_t slot = accLogStart + first;
+    if (slot >= (uint32_t)accLogLength)
+        slot -= accLogLength;
+    uint32_t n = MIN(count, accLogLength - slot);
+    uint32_t crc = sendLogBytes((uint8_t*)&accLog[slot*3], n*3*sizeof(int16_t), 0);
+    if (n < count)
+        crc = sendLogBytes((uint8_t*)accLog, (count-n)*3*sizeof(int16_t), crc);
+    return crc;
+}
+
+void sendLogChunkTrailer(uint8_t flags, uint32_t count, uint32_t first, uint32_t crc, uint32_t total) {
+    uint8_t trailer[LOG_CHUNK_TRAILER_SIZE];
+
+    encodeLogChunkTrailer(trailer, flags, count, first, crc, total);
+    session->out.write(trailer, sizeof(trailer));
+    session->out.endTransfer();
+}
+
+// Send the next chunk, returns true after the last one. There is always
+// at least one chunk, so an empty range still gets its LOG_CHUNK_LAST.
+bool sendLogBinaryChunk() {
+    uint32_t chunk = logBinChunk;
+    uint32_t count = MIN(LOG_CHUNK_SAMPLES, logBinEnd - chunk);
+    uint32_t crc;
+
+    if (accLogCompressed) {
+        int16_t xyz[LOG_CHUNK_SAMPLES*3];
+        for (uint32_t i=0; i<count; i++)
+            accDeltaLog.next(&xyz[i*3]);
+        crc = sendLogBytes((uint8_t*)xyz, count*3*sizeof(int16_t), 0);
+    } else {
+        crc = sendLogSamples(chunk, count);
+    }
+    logBinChunk += count;
+
+    sendLogChunkTrailer((logBinChunk == logBinEnd) ? LOG_CHUNK_LAST : 0, count, chunk,
+                        crc, accLoggedDataLength/3);
+    return logBinChunk == logBinEnd;
+}
+
+// Text log download, a few lines per main loop pass
+#define LOG_LINES_PER_STEP 16
+
+int logDumpIndex = 0;  // Next value in accLog order
+
+void beginLogText() {
+    session->out.print("{\"datatype\":\"AccelerometerLog\",\n\"accelrange\":");
+    session->out.printInt(_accelerometerRange);
+    session->out.print(",\n\"accelfactor\":");
+    session->out.printInt(8192 / _accelerometerRange);
+    session->out.print(",\n\"samplingrate\":");
+    session->out.printInt(accLogRate);
+    session->out.print(",\n\"pretrigger\":");
+    session->out.printInt(accLogPretrigger);
+    printLogSettings();
+    session->out.print(",\n\"timestamp\":");
+    session->out.printUInt(accLogTimestamp);
+    sendString(",\n\"data\":[\n");
+    // Walk the log in place from the oldest sample, wrapping at the end,
+    // or decompress it sample by sample
+    accLogPtr = &accLog[accLogStart*3];
+    accDeltaLog.rewind();
+    logDumpIndex = 0;
+}
+
+// Send the next lines, returns true when the log is complete
+bool sendLogTextLines() {
+    for (int n=0; n<LOG_LINES_PER_STEP && logDumpIndex<accLoggedDataLength; n++) {
+        int16_t xyz[3];
+        int16_t* sample = accLogPtr;
+        if (accLogCompressed) {
+            accDeltaLog.next(xyz);
+            sample = xyz;
+        } else {
+            accLogPtr += 3;
+            if (accLogPtr == &accLog[accLogSize])
+                accLogPtr = accLog;
+        }
+        logDumpIndex += 3;
+        printLogLine(session->out, sample, logDumpIndex>=accLoggedDataLength);
+    }
+    if (logDumpIndex < accLoggedDataLength)
+        return false;
+    sendString("]}\n");
+    return true;
+}
+
+Session* logDumpSession = 0;  // Where a GETLOG or GETBIN download goes
+bool logDumpAck = false;      // The download was requested with an id
+int32_t logDumpAckId;
+uint32_t logDumpStart = 0;    // us_ticker time of the download command
+
+bool downloading() {
+    return currentState == GET_LOG_STATE || currentState == GET_BIN_STATE;
+}
+
+void sendDownloadBusy() {
+    commandStatus = CMD_BUSY;
+    sendString("{\"datatype\":\"StatusMessage\",\"data\":\"Download in progress.\"}\n");
+}
+
+// GETLOG and GETBIN need the log to themselves
+bool logUnavailable() {
+    if (logRecording || logArmed) {
+        sendLogBusy();
+        return true;
+    }
+    if (downloading()) {
+        sendDownloadBusy();
+        return true;
+    }
+    if (session->tailing) {
+        commandStatus = CMD_BUSY;
+        sendString("{\"datatype\":\"StatusMessage\",\"data\":\"Log tail in progress.\"}\n");
+        return true;
+    }
+    return false;
+}
+
+// Live log tail
+// TAILOG follows the log while it records, in the GETBIN chunk format:
+// each chunk carries the samples from the session's cursor that are in
+// accLog so far, and its total field is the count recorded so far. The
+// log itself is never held back, a host that falls behind just gets
+// bigger catch-up chunks, and TAILOG with any sample index resumes from
+// there. The chunk with LOG_CHUNK_LAST is sent once the recording has
+// ended and the host has everything.
+#define TAIL_INTERVAL_US 100000  // Partial chunks at most this often
+
+// A LOGACC log still to come or being recorded: waiting for its swipe,
+// trigger or countdown, armed, or recording
+bool logPending() {
+    return logRecording || logArmed || currentState == LOG_ACC_STATE ||
+           currentState == ACC_READY_STATE || currentState == ACC_LOGGING_STATE;
+}
+
+// Samples of the current log in accLog so far, more is set while the log
+// is still waiting for its start or recording. Until it records, the
+// previous log is not available. Pre-trigger logs rewrite their ring
+// until they finish, so they are only available then.
+uint32_t logAvailable(bool* more) {
+    *more = logPending();
+    if (currentState == ACC_LOGGING_STATE)
+        return logRecorded;
+    return *more ? 0 : accLoggedDataLength/3;
+}
+
+void endTail(Session& s, const char* message) {
+    s.tailing = false;
+    session = &s;
+    sendString(message);
+}
+
+void stepTail(Session& s) {
+    bool more;
+    uint32_t total = logAvailable(&more);
+
+    if (s.tailLog != logGeneration) {
+        endTail(s, "{\"datatype\":\"StatusMessage\",\"data\":\"Log tail ended, the log was cancelled or restarted.\"}\n");
+        return;
+    }
+    // Delta compressed samples can only be decoded from the start
+    if (total && accLogCompressed) {
+        endTail(s, "{\"datatype\":\"StatusMessage\",\"data\":\"Log tail needs an uncompressed log ({'SETCMP':0}).\"}\n");
         return;
+    }
 
-    _stream_sampling_rate = rate;
-    _stream_sampling_wait_us = (1000000 / rate);
+    uint32_t first = MIN(s.tailNext, total);
+    uint32_t count = MIN(LOG_CHUNK_SAMPLES, total - first);
+    bool last = !more && first + count == total;
+    uint32_t now = us_ticker_read();
+    if (!last && (count == 0 || (count < LOG_CHUNK_SAMPLES && now - s.tailSent < TAIL_INTERVAL_US)))
+        return;
+    // Like GETBIN, each chunk waits for an empty TX queue
+    if (webUSB.txFree(s.isCDC) < USB_TX_QUEUE_PACKETS)
+        return;
+
+    session = &s;
+    uint32_t crc = count ? sendLogSamples(first, count) : 0;
+    sendLogChunkTrailer(last ? LOG_CHUNK_LAST : 0, count, first, crc, total);
+    s.tailNext = first + count;
+    s.tailSent = now;
+    if (last)
+        s.tailing = false;
 }
 
-// Communication
-// VID/PID assigned here: https://github.com/pidcodes/pidcodes.github.com/blob/master/1209/D017/index.md
-WebUSBCDC webUSB(0x1209, 0xD017, 0x0001, true);
+void cmdTailLog(const Command* cmd) {
+    int first = commandValue(cmd);
+
+    if (first < 0) {
+        session->tailing = false;
+        return;
+    }
+    if (logDumpSession == session && downloading()) {
+        sendDownloadBusy();
+        return;
+    }
+    session->out.print("{\"datatype\":\"AccelerometerLogTail\",\n\"accelrange\":");
+    session->out.printInt(_accelerometerRange);
+    session->out.print(",\n\"accelfactor\":");
+    session->out.printInt(8192 / _accelerometerRange);
+    session->out.print(",\n\"samplingrate\":");
+    // Rates cannot change while a log waits or records
+    session->out.printInt(logPending() ? _stream_sampling_rate : accLogRate);
+    session->out.print(",\n\"offset\":");
+    session->out.printInt(first);
+    sendString("}\n");
+
+    session->tailing = true;
+    session->tailNext = first;
+    session->tailSent = us_ticker_read() - TAIL_INTERVAL_US;
+    session->tailLog = logGeneration;
+}
+
+void runBenchmark();
 
-uint8_t* rbuf;
-uint32_t rbuf_len = 0;
-uint32_t read_size;
+void cmdBenchmark(const Command* cmd) {
+    runBenchmark();
+}
 
-uint8_t* rbuf_cdc;
-uint32_t rbuf_len_cdc = 0;
-uint32_t read_size_cdc;
+void cmdGetBinary(const Command* cmd) {
+    if (logUnavailable())
+        return;
+    logRangeOffset = 0;
+    logRangeLength = 0xFFFFFFFF;  // Whole log, the range is clipped to what was recorded
+    if (cmd->type == CMD_VALUE_ARRAY && cmd->valueCount == 2 && cmd->values[0] >= 0 && cmd->values[1] >= 0) {
+        logRangeOffset = cmd->values[0];
+        logRangeLength = cmd->values[1];
+    }
+    logDumpStart = us_ticker_read();
+    beginLogBinary();
+    logDumpSession = session;
+    logDumpAck = false;
+    commandDeferred = true;
+    currentState = GET_BIN_STATE;
+}
 
-char* sbuf;
+void cmdGetInfo(const Command* cmd) {
+    sendHardwareInformation();
+}
 
+void cmdGetLog(const Command* cmd) {
+    if (logUnavailable())
+        return;
+    logDumpStart = us_ticker_read();
+    beginLogText();
+    logDumpSession = session;
+    logDumpAck = false;
+    commandDeferred = true;
+    currentState = GET_LOG_STATE;
+}
 
-void sendString(const char* str, bool isCDC=false) {
-    int len = strlen(str);
-    uint32_t byte_count;
-    uint8_t* byte_ptr = (uint8_t*)str;
+void cmdGetStatus(const Command* cmd) {
+    sendStatus();
+}
 
-    while(len>0) {
-        byte_count = MIN(MAX_PACKET_SIZE_EPBULK, len);
-        webUSB.write(byte_ptr, byte_count);
-        len-=MAX_PACKET_SIZE_EPBULK;
-        byte_ptr+=byte_count;
+void cmdLogAcc(const Command* cmd) {
+    // A recording or a pre-trigger log capturing its post-trigger samples
+    // is kept, re-arming only replaces a log still waiting for its trigger
+    if (logRecording || currentState == ACC_TRIGGERED_STATE) {
+        sendLogBusy();
+        return;
+    }
+    // The new log would overwrite accLog under the download
+    if (downloading()) {
+        sendDownloadBusy();
+        return;
+    }
+    logGeneration++;
+    if (logArmed)
+        disarmLog();  // Re-arm from scratch, the sensor is reconfigured below
+    // The log clock owns the accelerometer while armed
+    if ((_acc_log_pretrigger || _acc_log_trigger) && samplerRunning)
+        stopSampler();
+    logSession = session;
+    setStreamSamplingRate(session->samplingRate);
+    if (_acc_log_trigger) {
+        armMotionTrigger();
+        if (!_acc_log_pretrigger)
+            logRecording = true;  // The interrupt starts the one-shot recording
     }
+    if (_acc_log_pretrigger)
+        armLog();
+    currentState = LOG_ACC_STATE;
 }
 
-void sendHardwareInformation() {
+void cmdNotify(const Command* cmd) {
+    session->sendNotifications = commandValue(cmd);
+}
 
-    sendString("{\"datatype\":\"HardwareInfo\",\n");
-#if defined(TARGET_KL25Z)
-    sendString("\"devicetype\":\"empiriKit|MOTION\",\n");
-#elif defined(TARGET_KL46Z)
-    sendString("\"devicetype\":\"empiriKit|KL46Z\",\n");
-#endif
-    sprintf(sbuf,"\"version\":\"%s\",\n\"uid\":\"0x%04X%08X%08X\",\n",
-        versionString,
-        *((unsigned int *)0x40048058),
-        *((unsigned int *)0x4004805C),
-        *((unsigned int *)0x40048060));
-    sendString(sbuf);
-    sendString("\"capabilities\":[\n");
-    sendString("\"accelerometer\",\n");
-#if defined(TARGET_KL25Z)
-    sendString("\"rgbled\",\n");
-#elif defined(TARGET_KL46Z)
-    sendString("\"magnetometer\",\n");
-    sendString("\"lightsensor\",\n");
-    sendString("\"lcd4num\",\n");
-#endif
-    sendString("\"touchsensor\"\n");
-    sendString("]}");
+void cmdResetStatus(const Command* cmd) {
+    resetStats();
+}
+
+void cmdSetBatch(const Command* cmd) {
+    setStreamBatchSize(commandValue(cmd));
+}
+
+void cmdSetCompress(const Command* cmd) {
+    _acc_log_compress = commandValue(cmd);
 }
 
-int params[10];
+void cmdStopLog(const Command* cmd);
 
-void handleCMD(uint8_t* cmd_buf, uint32_t size) {
-    // very crude "json" parsing. We should put e.g. picoJSON in place here
+void cmdSetDrop(const Command* cmd) {
+    session->dropOldest = commandValue(cmd);
+}
 
-    // Send help string if the command is too short to make sense.
-    if(size < 12) {
-        sendString(helpString);
+void cmdSetFilter(const Command* cmd) {
+    int factor = commandValue(cmd);
+    if (!CicDecimator::isValidFactor(factor) || !isValidAccRate(_stream_sampling_rate * factor)) {
+        commandStatus = CMD_INVALID;
+        return;
+    }
+    if (logRecording || logArmed) {
+        sendLogBusy();
         return;
     }
 
-    char *cmdPtr = (char*)(&cmd_buf[2]);
-    char *valPtr = (char*)(&cmd_buf[10]);
+    if (samplerRunning)
+        stopSampler();  // The main loop restarts it at the new read rate
+    accFilter.setFactor(factor);
+    setStreamSamplingRate(_stream_sampling_rate);
+    updateSampler();
+}
 
-    if (strncmp(cmdPtr,"SETIDL",6) == 0){
-        accelerometerStreaming = 0;
-        touchStreaming = 0;
-        setStreamSamplingRate(DEFAULT_SAMPLING_RATE);
-        currentState = IDLE_STATE;
-    } else if (strncmp(cmdPtr,"LOGACC",6) == 0){
-        currentState = LOG_ACC_STATE;
-    } else if (strncmp(cmdPtr,"NOTIFY",6) == 0){
-        sscanf(valPtr,"%i",&sendNotifications);
-#if defined(TARGET_KL25Z)
-    } else if (strncmp(cmdPtr,"SETRGB",6) == 0){
-        sscanf(valPtr,"[%d,%d,%d]",&params[0], &params[1], &params[2]);
-        setRGB(params[0], params[1], params[2]);
-#elif defined(TARGET_KL46Z)
-    } else if (strncmp(cmdPtr,"SETLCD",6) == 0){
-        // TODO:  Set LCD string, currently only number
-        sscanf(valPtr,"%d",&params[0]);
-        lcd.printf("%4d", params[0]);
+void cmdSetIdle(const Command* cmd) {
+    if (logRecording || logArmed)
+        cmdStopLog(cmd);
+    session->sensors = 0;
+    for (int i=0; i<STREAM_SENSOR_COUNT; i++)
+        session->sensorRate[i] = 0;
+    session->binaryStreaming = 0;
+    session->dropOldest = 0;
+    session->samplingRate = DEFAULT_SAMPLING_RATE;
+    setStreamBatchSize(DEFAULT_BATCH_SIZE);
+    updateSampler();
+    if (!downloading())
+        currentState = IDLE_STATE;  // A download still ends with its ]} or LOG_CHUNK_LAST
+}
+
+// Per sensor rate, the accelerometer rate is SETRTE
+void cmdSetSensorRate(const Command* cmd) {
+    if (cmd->valueCount != 2) {
+        commandStatus = CMD_INVALID;
+        return;
+    }
+    int sensor = cmd->values[0];
+    int rate = cmd->values[1];
+    if (sensor < 0 || sensor >= STREAM_SENSOR_COUNT || sensor == STREAM_SENSOR_ACC ||
+        !(SENSORS_AVAILABLE & (1 << sensor)) || rate < 0 || (uint32_t)rate > sensorMaxRate[sensor]) {
+        commandStatus = CMD_INVALID;
+        return;
+    }
+
+    session->sensorRate[sensor] = rate;
+    updateSampler();
+}
+
+// Dead band of one sensor, in its raw units
+void cmdSetDeadband(const Command* cmd) {
+    if (cmd->valueCount != 2) {
+        commandStatus = CMD_INVALID;
+        return;
+    }
+    int sensor = cmd->values[0];
+    int delta = cmd->values[1];
+    if (sensor < 0 || sensor >= STREAM_SENSOR_COUNT || !(SENSORS_AVAILABLE & (1 << sensor)) ||
+        delta < 0 || delta > 0xFFFF) {
+        commandStatus = CMD_INVALID;
+        return;
+    }
+
+    session->deadband[sensor] = delta;
+    if (delta)
+        session->deadbandSensors |= 1 << sensor;
+    else
+        session->deadbandSensors &= ~(1 << sensor);
+    session->held &= ~(1 << sensor);  // The next reading goes out
+}
+
+void cmdSetKeyframe(const Command* cmd) {
+    int ms = commandValue(cmd);
+    if (ms < 0 || ms > MAX_KEYFRAME_MS) {
+        commandStatus = CMD_INVALID;
+        return;
+    }
+
+    session->keyframeUs = ms*1000;
+}
+
+void cmdSetTrigger(const Command* cmd) {
+    int trigger = commandValue(cmd);
+    if (trigger < 0 || trigger > MMA8451Q_PULSE) {
+        commandStatus = CMD_INVALID;
+        return;
+    }
+    if (logRecording || logArmed) {
+        sendLogBusy();
+        return;
+    }
+    if (cmd->type == CMD_VALUE_ARRAY) {
+        if (cmd->valueCount != 3 || cmd->values[1] < 0 || cmd->values[1] > MMA8451Q_MOTION_MAX_MG ||
+            cmd->values[2] < 0 || cmd->values[2] > 255) {
+            commandStatus = CMD_INVALID;
+            return;
+        }
+        _acc_log_threshold = cmd->values[1];
+        _acc_log_count = cmd->values[2];
+    }
+    _acc_log_trigger = trigger;
+}
+
+void cmdSetPretrigger(const Command* cmd) {
+    setLogPretrigger(commandValue(cmd));
+}
+
+void cmdSetRate(const Command* cmd) {
+    if (!isValidSamplingRate(commandValue(cmd))) {
+        commandStatus = CMD_INVALID;
+        return;
+    }
+    // The log clock runs at the rate its header reports
+    if (logRecording || logArmed) {
+        sendLogBusy();
+        return;
+    }
+
+    session->samplingRate = commandValue(cmd);
+    updateSampler();
+}
+
+// End a recording now, keeping what was logged so far, or drop a log
+// that has not started recording yet
+void cmdStopLog(const Command* cmd) {
+    // A motion trigger that already fired has started the log
+    if (motionArmed) {
+        accInt.disable_irq();
+        checkMotionTrigger();
+    }
+    switch (currentState) {
+        case LOG_ACC_STATE:
+        case ACC_READY_STATE:
+            cancelLog();
+            break;
+        case ACC_LOGGING_STATE:
+            stopRecording();
+            break;
+        case ACC_TRIGGERED_STATE:
+            finishLog();
+            logEnded();
+            break;
+        default:
+            break;
+    }
+}
+
+void streamSensor(uint8_t bit, int on) {
+    session->held &= ~bit;  // Nothing held from an earlier stream
+    if (on)
+        session->sensors |= bit;
+    else
+        session->sensors &= ~bit;
+}
+
+void cmdStreamAcc(const Command* cmd) {
+    streamSensor(STREAM_FRAME_ACC, commandValue(cmd));
+}
+
+void cmdStreamBinary(const Command* cmd) {
+    session->binaryStreaming = commandValue(cmd);
+}
+
+void cmdStreamTouch(const Command* cmd) {
+    streamSensor(STREAM_FRAME_TOUCH, commandValue(cmd));
+}
+
+#if defined(TARGET_KL46Z)
+void cmdStreamLight(const Command* cmd) {
+    streamSensor(STREAM_FRAME_LIGHT, commandValue(cmd));
+}
+
+void cmdStreamMag(const Command* cmd) {
+    if (commandValue(cmd) && !magPresent) {
+        commandStatus = CMD_INVALID;
+        sendString("{\"datatype\":\"StatusMessage\",\"data\":\"No magnetometer.\"}\n");
+        return;
+    }
+    streamSensor(STREAM_FRAME_MAG, commandValue(cmd));
+}
 #endif
-    } else if (strncmp(cmdPtr,"SETRTE",6) == 0){
-        setStreamSamplingRate(params[0]);
-    } else if (strncmp(cmdPtr,"STRTCH",6) == 0){
-        sscanf(valPtr,"%i",&touchStreaming);
-    } else if (strncmp(cmdPtr,"STRACC",6) == 0){
-        sscanf(valPtr,"%i",&accelerometerStreaming);
-    } else if (strncmp(cmdPtr,"GETINF",6) == 0){
-        sendHardwareInformation();
-    } else if (strncmp(cmdPtr,"GETLOG",6) == 0){
-        currentState = GET_LOG_STATE;
+
+// Commands available on all targets, keep sorted by name
+const CommandEntry commonCommands[] = {
+    { COMMAND('G','E','T','B','E','N'), CMD_ARG_ANY, cmdBenchmark,
+      "Run the on-target benchmark of the streaming and logging paths ({'GETBEN':1})" },
+    { COMMAND('G','E','T','B','I','N'), CMD_ARG_ANY, cmdGetBinary,
+      "Get logged accelerometer data as binary chunks ({'GETBIN':1} or {'GETBIN':[offset,length]})" },
+    { COMMAND('G','E','T','I','N','F'), CMD_ARG_ANY, cmdGetInfo,
+      "Get hardware and firmware information, ({'GETINF':1})" },
+    { COMMAND('G','E','T','L','O','G'), CMD_ARG_ANY, cmdGetLog,
+      "Get logged accelerometer data, ({'GETLOG':1})" },
+    { COMMAND('G','E','T','S','T','S'), CMD_ARG_ANY, cmdGetStatus,
+      "Get timing and throughput statistics ({'GETSTS':1})" },
+    { COMMAND('L','O','G','A','C','C'), CMD_ARG_ANY, cmdLogAcc,
+      "Start logging accelerometer data ({'LOGACC':1})" },
+    { COMMAND('N','O','T','I','F','Y'), CMD_ARG_INT, cmdNotify,
+      "Send state change notifications ({'NOTIFY':x}, x = 0(off) or 1(on))" },
+    { COMMAND('R','S','T','S','T','S'), CMD_ARG_ANY, cmdResetStatus,
+      "Clear the GETSTS statistics ({'RSTSTS':1})" },
+    { COMMAND('S','E','N','R','T','E'), CMD_ARG_ARRAY, cmdSetSensorRate,
+      "Set the rate of one sensor ({'SENRTE':[sensor,x]}, sensor = 0(touch), 2(magnetometer) or 3(light), x in Hz, 0 follows SETRTE)" },
+    { COMMAND('S','E','T','B','A','T'), CMD_ARG_INT, cmdSetBatch,
+      "Samples per USB packet when streaming ({'SETBAT':x}, 1 <= x <= 32)" },
+    { COMMAND('S','E','T','C','M','P'), CMD_ARG_INT, cmdSetCompress,
+      "Compress the accelerometer log to record longer ({'SETCMP':x}, x = 0(off) or 1(on))" },
+    { COMMAND('S','E','T','D','B','D'), CMD_ARG_ARRAY, cmdSetDeadband,
+      "Only stream a sensor when it changes more than x from its last sent value ({'SETDBD':[sensor,x]}, sensor = 0(touch), 1(accelerometer), 2(magnetometer) or 3(light), x = 0(off) or raw units)" },
+    { COMMAND('S','E','T','D','R','P'), CMD_ARG_INT, cmdSetDrop,
+      "Stream policy when the host falls behind ({'SETDRP':x}, x = 0(drop newest) or 1(drop oldest))" },
+    { COMMAND('S','E','T','F','L','T'), CMD_ARG_INT, cmdSetFilter,
+      "Low-pass filter and decimate the accelerometer ({'SETFLT':x}, x = 1(off), 2, 4, 8, 16 or 32 reads per sample)" },
+    { COMMAND('S','E','T','I','D','L'), CMD_ARG_ANY, cmdSetIdle,
+      "Stop streaming and logging and restore defaults ({'SETIDL':1})" },
+    { COMMAND('S','E','T','K','E','Y'), CMD_ARG_INT, cmdSetKeyframe,
+      "Repeat dead-banded sensors in a keyframe at least this often ({'SETKEY':x}, x in ms, 0(off) <= x <= 60000)" },
+    { COMMAND('S','E','T','P','R','E'), CMD_ARG_INT, cmdSetPretrigger,
+      "Samples to keep from before the logging trigger ({'SETPRE':x}, 0(off) <= x < logcapacity from GETINF)" },
+    { COMMAND('S','E','T','R','T','E'), CMD_ARG_INT, cmdSetRate,
+      "Set sampling rate ({'SETRTE':x}, 1 <= x <= 100, or 200, 400, 800)" },
+    { COMMAND('S','E','T','T','R','G'), CMD_ARG_INT | CMD_ARG_ARRAY, cmdSetTrigger,
+      "What starts a log ({'SETTRG':x} or {'SETTRG':[x,mg,count]}, x = 0(touch), 1(transient), 2(freefall) or 3(pulse), mg <= 8001 in 63 mg steps)" },
+    { COMMAND('S','T','O','P','L','O'), CMD_ARG_ANY, cmdStopLog,
+      "Stop logging now, keeping the samples recorded so far ({'STOPLOG':1})" },
+    { COMMAND('S','T','R','A','C','C'), CMD_ARG_INT, cmdStreamAcc,
+      "Stream accelerometer values ({'STRACC':x}, x = 0(off) or 1(on))" },
+    { COMMAND('S','T','R','B','I','N'), CMD_ARG_INT, cmdStreamBinary,
+      "Stream format ({'STRBIN':x}, x = 0(JSON text) or 1(binary frames))" },
+    { COMMAND('S','T','R','T','C','H'), CMD_ARG_INT, cmdStreamTouch,
+      "Stream touch values ({'STRTCH':x}, x = 0(off) or 1(on))" },
+    { COMMAND('T','A','I','L','O','G'), CMD_ARG_INT, cmdTailLog,
+      "Follow the accelerometer log as binary chunks while it records ({'TAILOG':x}, x = first sample, -1(stop))" },
+};
+
+void sendHelp() {
+    session->out.print("{\"msg\":[\"CMD => Description\",");
+    for (unsigned int i=0; i<COMMAND_COUNT(commonCommands); i++) {
+        session->out.print("\"");
+        session->out.print(commonCommands[i].name);
+        session->out.print(" => ");
+        session->out.print(commonCommands[i].help);
+        session->out.print("\",");
+    }
+    for (unsigned int i=0; i<COMMAND_COUNT(targetCommands); i++) {
+        session->out.print("\"");
+        session->out.print(targetCommands[i].name);
+        session->out.print(" => ");
+        session->out.print(targetCommands[i].help);
+        session->out.print("\",");
+    }
+    session->out.print("\"Only the first 6 characters of a name count, {'STOPLOG':1} is STOPLO\",");
+    session->out.print("\"Add 'id':n to any command for an Ack with its status, e.g. {'SETRTE':20,'id':1}\",");
+    sendString("\"Visit www.empirikit.com for more information.\"]}");
+}
+
+// On-target benchmark
+// Times the encoding hot paths with the SysTick cycle counter against a
+// discarding writer, so nothing is sent while measuring. Results are
+// per item, averaged over BENCH_ITERATIONS.
+#define BENCH_ITERATIONS 100
+#define BENCH_SAMPLES 16
+
+PacketWriter benchOut(webUSB, false, true);
+
+void sendBenchResult(const char* name, uint32_t cycles, uint32_t bytes, bool last) {
+    session->out.print("{\"name\":\"");
+    session->out.print(name);
+    session->out.print("\",\"cycles\":");
+    session->out.printInt(cycles / BENCH_ITERATIONS);
+    session->out.print(",\"bytes\":");
+    session->out.printInt(bytes / BENCH_ITERATIONS);
+    session->out.print(last ? "}\n" : "},\n");
+}
+
+void runBenchmark() {
+    static const char benchCommand[] = "{'SETRTE':50}";
+    int16_t samples[BENCH_SAMPLES][3];
+    uint8_t fbuf[STREAM_FRAME_MAX_SIZE];
+    uint8_t deltaBuf[256];
+    DeltaLog deltaLog;
+    CicDecimator benchFilter;
+    int16_t filtered[3];
+    char text[40];
+    CommandParser benchParser;
+    StreamFrame frame;
+    uint32_t start, cycles, bytes;
+
+    // Synthetic, slowly moving accelerometer data
+    for (int i=0; i<BENCH_SAMPLES; i++) {
+        samples[i][0] = i*37 - 300;
+        samples[i][1] = 120 - i*11;
+        samples[i][2] = 1010 + ((i*7) & 31);
+    }
+    frame.mask = STREAM_FRAME_TOUCH | STREAM_FRAME_ACC;
+    frame.touch = 25;
+
+    session->out.print("{\"datatype\":\"Benchmark\",\n\"version\":\"");
+    session->out.print(versionString);
+    session->out.print("\",\n\"cpuclock\":");
+    session->out.printInt(SystemCoreClock);
+    session->out.print(",\n\"iterations\":");
+    session->out.printInt(BENCH_ITERATIONS);
+    session->out.print(",\n\"usbbytes\":");
+    session->out.printInt(session->out.bytesWritten());
+    session->out.print(",\n\"usbpackets\":");
+    session->out.printInt(session->out.packetsSent());
+    // Live figures since the last RSTSTS: packet rate of this session,
+    // worst case command handling and log download times, all in us
+    uint32_t elapsed = us_ticker_read() - statsStart;
+    session->out.print(",\n\"elapsed\":");
+    session->out.printUInt(elapsed);
+    session->out.print(",\n\"usbpacketrate\":");
+    session->out.printUInt(elapsed ? (uint64_t)session->out.packetsSent() * 1000000 / elapsed : 0);
+    printTimeStat("command", commandTime);
+    printTimeStat("getlog", logTextTime);
+    printTimeStat("getbin", logBinaryTime);
+    session->out.print(",\n\"results\":[\n");
+
+    bytes = 0;
+    start = cycleCount();
+    for (int i=0; i<BENCH_ITERATIONS; i++) {
+        frame.seq = i;
+        memcpy(frame.acc, samples[i % BENCH_SAMPLES], sizeof(frame.acc));
+        bytes += encodeStreamFrame(&frame, fbuf);
+    }
+    cycles = cyclesSince(start);
+    sendBenchResult("streambinary", cycles, bytes, false);
+
+    bytes = benchOut.bytesWritten();
+    start = cycleCount();
+    for (int i=0; i<BENCH_ITERATIONS; i++) {
+        memcpy(frame.acc, samples[i % BENCH_SAMPLES], sizeof(frame.acc));
+        printStreamFrame(benchOut, &frame, _stream_sampling_rate);
+    }
+    cycles = cyclesSince(start);
+    sendBenchResult("streamjson", cycles, benchOut.bytesWritten() - bytes, false);
+
+    bytes = benchOut.bytesWritten();
+    start = cycleCount();
+    for (int i=0; i<BENCH_ITERATIONS; i++)
+        printLogLine(benchOut, samples[i % BENCH_SAMPLES], false);
+    cycles = cyclesSince(start);
+    sendBenchResult("logline", cycles, benchOut.bytesWritten() - bytes, false);
+
+    bytes = 0;
+    deltaLog.begin(deltaBuf, sizeof(deltaBuf));
+    start = cycleCount();
+    for (int i=0; i<BENCH_ITERATIONS; i++) {
+        if (!deltaLog.append(samples[i % BENCH_SAMPLES])) {
+            bytes += deltaLog.bytesUsed();
+            deltaLog.begin(deltaBuf, sizeof(deltaBuf));
+            deltaLog.append(samples[i % BENCH_SAMPLES]);
+        }
+    }
+    deltaLog.finish();
+    cycles = cyclesSince(start);
+    sendBenchResult("deltalog", cycles, bytes + deltaLog.bytesUsed(), false);
+
+    // Per input sample, 8 inputs per output
+    bytes = 0;
+    benchFilter.setFactor(8);
+    start = cycleCount();
+    for (int i=0; i<BENCH_ITERATIONS; i++) {
+        if (benchFilter.push(samples[i % BENCH_SAMPLES], filtered))
+            bytes += sizeof(filtered);
+    }
+    cycles = cyclesSince(start);
+    sendBenchResult("decimate", cycles, bytes, false);
+
+    // One "x,y,z" line, divide-free against newlib
+    bytes = 0;
+    start = cycleCount();
+    for (int i=0; i<BENCH_ITERATIONS; i++) {
+        const int16_t* xyz = samples[i % BENCH_SAMPLES];
+        char* p = text;
+        p += intToText<0,' '>(xyz[0], p);
+        *p++ = ',';
+        p += intToText<0,' '>(xyz[1], p);
+        *p++ = ',';
+        p += intToText<0,' '>(xyz[2], p);
+        bytes += p - text;
+    }
+    cycles = cyclesSince(start);
+    sendBenchResult("inttext", cycles, bytes, false);
+
+    bytes = 0;
+    start = cycleCount();
+    for (int i=0; i<BENCH_ITERATIONS; i++) {
+        const int16_t* xyz = samples[i % BENCH_SAMPLES];
+        bytes += sprintf(text, "%d,%d,%d", xyz[0], xyz[1], xyz[2]);
+    }
+    cycles = cyclesSince(start);
+    sendBenchResult("sprintf", cycles, bytes, false);
+
+    bytes = 0;
+    start = cycleCount();
+    for (int i=0; i<BENCH_ITERATIONS; i++) {
+        for (const char* c = benchCommand; *c; c++) {
+            if (benchParser.feed(*c) == PARSE_COMMAND)
+                findCommand(commonCommands, COMMAND_COUNT(commonCommands), benchParser.command()->key);
+        }
+        bytes += sizeof(benchCommand) - 1;
+    }
+    cycles = cyclesSince(start);
+    sendBenchResult("command", cycles, bytes, true);
+
+    sendString("]}\n");
+}
+
+// Commands sent with an 'id' are answered with an Ack once handled, after
+// any reply of their own. Acks are staged, not flushed, so the acks of
+// commands pipelined in one packet share USB packets too. GETLOG and
+// GETBIN are acked after the last line or chunk of their download, so
+// the Ack never lands inside it.
+void sendAck(int32_t id, CMD_STATUS status) {
+    session->out.print("{\"datatype\":\"Ack\",\"id\":");
+    session->out.printInt(id);
+    session->out.print(",\"status\":\"");
+    session->out.print(commandStatusName(status));
+    session->out.print("\"}\n");
+}
+
+// A GETLOG or GETBIN download has sent everything
+void endLogDump() {
+    if (currentState == GET_LOG_STATE)
+        logTextTime.add(us_ticker_read() - logDumpStart);
+    else
+        logBinaryTime.add(us_ticker_read() - logDumpStart);
+    if (logDumpAck) {
+        logDumpAck = false;
+        sendAck(logDumpAckId, CMD_OK);
+        session->out.flush();
+    }
+    currentState = IDLE_STATE;
+}
+
+// Returns true if an Ack was staged
+bool handleCMD(const Command* cmd) {
+    const CommandEntry* entry = findCommand(commonCommands, COMMAND_COUNT(commonCommands), cmd->key);
+    if (!entry)
+        entry = findCommand(targetCommands, COMMAND_COUNT(targetCommands), cmd->key);
+
+    commandStatus = CMD_OK;
+    commandDeferred = false;
+    if (entry && commandAccepts(entry, cmd)) {
+        entry->handler(cmd);
+    } else if (cmd->hasId) {
+        commandStatus = entry ? CMD_INVALID : CMD_UNKNOWN;  // The Ack says it, no help text
     } else {
-        // send help string
-        sendString(helpString);
+        sendHelp();
+    }
+    if (!cmd->hasId)
+        return false;
+    if (commandDeferred) {
+        logDumpAck = true;
+        logDumpAckId = cmd->id;
+        return false;
     }
+    sendAck(cmd->id, commandStatus);
+    return true;
+}
+
+
+// The main loop sleeps between interrupts. USB packets are polled, so a
+// packet that lands just before sleep() would otherwise wait for the next
+// unrelated interrupt; this ticker bounds that wait.
+#define WAKE_INTERVAL_US 1000
+
+Ticker wakeTicker;
+
+void wakeISR() {
 }
 
+// Memory arena, carved up at the start of main()
+#if defined(TOOLCHAIN_GCC_ARM)
+// The linker script gives the heap everything between the end of the
+// statics and __StackLimit, the bottom of the stack section. The arena
+// is claimed from the heap with _sbrk() at the start of main(): all of
+// it up to HEAP_RESERVE below the stack reserve. Later allocations get
+// the reserve, and beyond it fail instead of growing into the log.
+extern "C" uint8_t __StackLimit[];
+extern "C" uint8_t __StackTop[];
+extern "C" void* _sbrk(int incr);
+
+MemoryArena memoryArena(0, 0);
+
+void sizeArena() {
+    uintptr_t heap = (uintptr_t)_sbrk(0);
+    uintptr_t base = (heap + 3) & ~3;
+    uintptr_t end = MIN((uintptr_t)__StackLimit, (uintptr_t)__StackTop - STACK_RESERVE) - HEAP_RESERVE;
+    if (end <= base || _sbrk(end - heap) == (void*)-1)
+        return;  // Empty, main() stops
+    memoryArena = MemoryArena((void*)base, end - base);
+}
+#else
+uint32_t arenaMemory[MEMORY_ARENA_SIZE/sizeof(uint32_t)];  // Word aligned
+MemoryArena memoryArena(arenaMemory, sizeof(arenaMemory));
 
-#define MAX_BUF_SIZE 1024
+void sizeArena() {
+}
+#endif
 
 int count = 0;
 
@@ -166,81 +2198,116 @@ int main()
     setRGB(255,0,0);
 #endif
 
+    if (!commandTableSorted(commonCommands, COMMAND_COUNT(commonCommands)) ||
+        !commandTableSorted(targetCommands, COMMAND_COUNT(targetCommands)))
+        error("Command table not sorted\r\n");
 
-    rbuf = new uint8_t[MAX_BUF_SIZE];
-    rbuf_cdc = new uint8_t[MAX_BUF_SIZE];
-
-    sbuf = new char[200];
-
-    accLog = new int16_t[ACC_LOG_SIZE];
+    // Fixed buffers first, the log takes the rest of the arena
+    sizeArena();
+    for (int i=0; i<SESSION_COUNT; i++) {
+        sessions[i]->rbuf = (uint8_t*)memoryArena.allocate(MAX_PACKET_SIZE_EPBULK);
+        if (!sessions[i]->rbuf)
+            error("Memory arena too small\r\n");
+    }
+    uint32_t logBytes;
+    accLog = (int16_t*)memoryArena.allocateRest(&logBytes);
+    accLogLength = logBytes / (3*sizeof(int16_t));
+    accLogSize = accLogLength*3;
+    measureStreamJson();
 
     currentState = IDLE_STATE;
 
 #if defined(TARGET_KL25Z)
     // Indicate power on with green LED (find alternative for KL46Z, e.g LCD)
-    if (accLog)
-        setRGB(0,255,0);
-    else {
-        setRGB(255,0,0);
-        while(1);
-    }
+    setRGB(0,255,0);
 #elif defined(TARGET_KL46Z)
     lcd.printf("RDY ");
 #endif
 
 
-    // Start the timer - used for precision sampling rate
-    loopTimer.reset();
-    loopTimer.start();
+    timer.start();
+    wakeTicker.attach_us(&wakeISR, WAKE_INTERVAL_US);
+    cycleCounterStart();
+    resetStats();
 
     while (true) {
-        // try to read from endpoint
-        if(webUSB.read(&rbuf[rbuf_len], &read_size)) {
-            sprintf(sbuf, "{\"msg\":\"Read %d bytes\"}",(int)read_size);
-            sendString(sbuf);
-
-            rbuf_len += read_size;
-            if(rbuf_len+MAX_PACKET_SIZE_EPBULK >= MAX_BUF_SIZE) {
-                // we are too close to the buffer limit (crude handling)
-                rbuf_len = 0;
-            }
-            uint32_t buf_pos = 0;
-            while(rbuf_len && buf_pos < rbuf_len) {
-                // crude "find the '}'"
-                if(rbuf[buf_pos] == '}') {
-                    sprintf(sbuf, "{\"msg\":\"Found end bracket at pos: %d\"}",(int)buf_pos);
-                    sendString(sbuf);
-
-                    handleCMD(rbuf, buf_pos+1);
-                    memmove(rbuf, &rbuf[buf_pos+1], rbuf_len-(buf_pos+1));
-                    rbuf_len-=buf_pos+1;
+        // Serve both interfaces, replies go out on the one the command came in on
+        for (int i=0; i<SESSION_COUNT; i++) {
+            Session& s = *sessions[i];
+            uint32_t read_size;
+
+            if (s.connected != webUSB.connected(s.isCDC)) {
+                s.connected = !s.connected;
+                if (!s.connected) {
+                    if (s.streaming)
+                        sampleRing.detach(i);  // reset() drops the session's streams
+                    s.reset();
+                    if (logDumpSession == &s && downloading())
+                        currentState = IDLE_STATE;  // Nobody left to download to
                 }
-                buf_pos++;
             }
+            if (!webUSB.read(s.rbuf, &read_size, s.isCDC))
+                continue;
+
+            uint32_t received = us_ticker_read();
+            uint32_t parseCycles = 0;
+            bool acked = false;
+            if (read_size > statsRxPeak)
+                statsRxPeak = read_size;
+            session = &s;
+            // Commands may be split across packets, the parser keeps its state
+            for (uint32_t j=0; j<read_size; j++) {
+                uint32_t start = cycleCount();
+                PARSE_RESULT result = s.parser.feed(s.rbuf[j]);
+                parseCycles += cyclesSince(start);
+                if (result == PARSE_COMMAND)
+                    acked |= handleCMD(s.parser.command());
+                else if (result == PARSE_ERROR)
+                    sendHelp();
+            }
+            parseTime.add(parseCycles);
+            if (acked)
+                s.out.flush();
+            commandTime.add(us_ticker_read() - received);
         }
+        updateSampler();
+        updateStreams();
 
         // Handle state
         switch (currentState) {
             case IDLE_STATE:
                 // TODO add battery status monitoring, USB connected?
 #if defined(XXTARGET_KL46Z)
-                    sprintf(lcdMessage, "%04d", tsi.readDistance());
-                    lcd.printf(lcdMessage);
+                    lcdPrintInt<4,'0'>("", tsi.readDistance(), "");
 #endif
                 break;
-            case LOG_ACC_STATE:
+            case LOG_ACC_STATE: {
+                // Waiting on the accelerometer, nothing to poll
+                if (motionArmed) {
+                    checkMotionTrigger();
+                    break;
+                }
+                // Touch is read once per UI tick, a swipe is much slower
+                if (!uiTickDue())
+                    break;
+                int touch = tsi.readDistance();
+                if (touch > 20) { // Should do:  Proper swipe detection.
+                    if (logArmed) {
+                        triggerLog();
+                        logTriggered();
+                    } else
+                        startCountdown();
+                    break;
+                }
 #if defined(TARGET_KL46Z)
-                    lcd.printf("LACC");
+                lcd.printf("LACC");
 #endif
                 count = (count<3)?count+1:0;
-                if (tsi.readDistance() > 20)  // Should do:  Proper swipe detection.
-                    currentState = ACC_READY_STATE;
-                else if (tsi.readDistance() > 0) {
+                if (touch > 0) {
 #if defined(TARGET_KL25Z)
-                    setRGB(0,0,tsi.readDistance() * 12);
+                    setRGB(0,0,touch * 12);
 #elif defined(TARGET_KL46Z)
-                    sprintf(lcdMessage, "%04d", tsi.readDistance());
-                    lcd.printf(lcdMessage);
+                    lcdPrintInt<4,'0'>("", touch, "");
 #endif
                 } else if (count == 0)
 #if defined(TARGET_KL25Z)
@@ -255,118 +2322,86 @@ int main()
                     lcd.printf("    ");
 #endif
                 break;
+            }
             case ACC_READY_STATE:
-#if defined(TARGET_KL25Z)
-                setRGB(255,0,0);
-#elif defined(TARGET_KL46Z)
-                lcd.printf("ACCR");
-#endif
-                // Blink red LED for 5s to indicate logging will start
-                for (int i=0; i<10; i++) {
-                    wait_ms(500);
-#if defined(TARGET_KL25Z)
-                    setRGB((i&1?0:255),0,0);
-#elif defined(TARGET_KL46Z)
-                    sprintf(lcdMessage, "-%2ds", (10-i)>>1);
-                    lcd.printf(lcdMessage);
-#endif
-                }
-                // Constant red LED to indicate recording
-                // The following line is commented out (for now) as we get a crash if we send data and are not connected.
-                if (sendNotifications)
-                    sendString("{\"datatype\":\"Notification\",\"data\":\"LoggingStarted\"}\n");
-#if defined(TARGET_KL25Z)
-                setRGB(255,0,0);
-#elif defined(TARGET_KL46Z)
-                lcd.printf("ACCR");
-#endif
-                accLoggedDataLength = ACC_LOG_LENGTH*3;
-                timer.reset();
-                timer.start();
-                accLogPtr = accLog; // Point at the beginning
-#if defined(TARGET_KL46Z)
-                lcd.DP2(1);
-#endif
-                for (int i=0; i<ACC_LOG_LENGTH; i++) {
-                    acc.getAccAllAxis(accLogPtr);
-                    accLogPtr += 3; // Check that this works... might need ++ three times.
-#if defined(TARGET_KL46Z)
-                    sprintf(lcdMessage, "%3ds", i/5);
-                    lcd.printf(lcdMessage);
-#endif
-                    while( timer.read_us() < _stream_sampling_wait_us );
-                    timer.reset();
-
-                    // Check if user swiped to stop logging (TODO: actual swipe detection ;))
-                    if (tsi.readDistance() > 20){
-                        accLoggedDataLength = i*3;
-                        break;
-                    }
-                }
-                timer.stop();
-#if defined(TARGET_KL46Z)
-                lcd.DP2(0);
-                lcd.printf("DONE");
-#endif
-                // The following line is commented out (for now) as we get a crash if we send data and are not connected.
-                if (sendNotifications)
-                    sendString("{\"datatype\":\"Notification\",\"data\":\"LoggingEnded\"}\n");
-                // Set green LED to indicate logging is done
-#if defined(TARGET_KL25Z)
-                setRGB(0,255,0);
-#endif
-                currentState = IDLE_STATE;  // Done, switch back
+                stepCountdown();
+                break;
+            case ACC_LOGGING_STATE:
+                stepRecording();
+                break;
+            case ACC_TRIGGERED_STATE:
+                // Pre-trigger log is recording the post-trigger samples
+                if (!logFrozen)
+                    break;
+                finishLog();
+                logEnded();
+                break;
+            case GET_BIN_STATE:
+                // Each step waits for an empty TX queue, so it never blocks
+                session = logDumpSession;
+                if (webUSB.txFree(session->isCDC) < USB_TX_QUEUE_PACKETS)
+                    break;
+                if (sendLogBinaryChunk())
+                    endLogDump();  // Done, switch back
                 break;
             case GET_LOG_STATE:
-                sprintf(sbuf, "{\"datatype\":\"AccelerometerLog\",\n" \
-                             "\"accelrange\":%d,\n" \
-                             "\"accelfactor\":%d,\n" \
-                             "\"samplingrate\":%d,\n" \
-                             "\"data\":[\n",  _accelerometerRange, 8192 / _accelerometerRange, _stream_sampling_rate);
-                sendString(sbuf);
-                for (int i=0; i<accLoggedDataLength; i=i+3) {
-                    if (i<(accLoggedDataLength-3))
-                        sprintf(sbuf,"[%d,%d,%d],\n",accLog[i],accLog[i+1],accLog[i+2]);
-                    else
-                        sprintf(sbuf,"[%d,%d,%d]\n",accLog[i],accLog[i+1],accLog[i+2]);
-                    sendString(sbuf);
-                }
-                sendString("]}\n");
-                currentState = IDLE_STATE;  // Done, switch back
+                session = logDumpSession;
+                if (webUSB.txFree(session->isCDC) < USB_TX_QUEUE_PACKETS)
+                    break;
+                if (sendLogTextLines())
+                    endLogDump();  // Done, switch back
                 break;
             default:
                 sendString("{\"datatype\":\"StatusMessage\",\"data\":\"Unexpected state.\"}\n");
         }
 
-        if (touchStreaming || accelerometerStreaming) {
-            // Use the high precision timer
-            while( loopTimer.read_us() < _stream_sampling_wait_us );
-            loopTimer.reset();
-            if (touchStreaming)
-                touchValue = tsi.readDistance();
-            if (accelerometerStreaming)
-                acc.getAccAllAxis(accXYZ);
-            // Separate reading and printing for better precision
-            sprintf(sbuf, "{\"datatype\":\"StreamData\",\n\"samplingrate\":%d", _stream_sampling_rate);
-            sendString(sbuf);
-            if (touchStreaming) {
-                sprintf(sbuf, ",\n\"touchsensordata\":%d", touchValue);
-                sendString(sbuf);
+        for (int i=0; i<SESSION_COUNT; i++) {
+            if (sessions[i]->tailing)
+                stepTail(*sessions[i]);
+        }
+
+        // A download in progress continues on the next pass, everything
+        // else waits for an interrupt
+        bool idle = !downloading();
+
+        if (sensorScheduler.enabled() && !logArmed && !logRecording) {
+            if (!samplerRunning) {
+                sampleRing.reset();
+                accFifoOverflows = 0;
+                for (int i=0; i<SESSION_COUNT; i++)
+                    sessions[i]->reportedOverruns = 0;
+                if (accHighRate)
+                    accFifo.flush();
+                startSampler();
             }
-            if (accelerometerStreaming) {
-                sprintf(sbuf, ",\n\"accelerometerdata\":[%d,%d,%d]",accXYZ[0],accXYZ[1],accXYZ[2]);
-                sendString(sbuf);
+            // Sleep until the next sample, USB packet or sent packet
+            for (int i=0; i<SESSION_COUNT; i++) {
+                if (!sessions[i]->streaming)
+                    continue;
+                bool hostBehind = drainSamples(*sessions[i], i);
+                if (sampleRing.count(i) && !hostBehind)
+                    idle = false;
             }
-            sendString("\n}");
         } else {
-            wait_ms(100);
-            loopTimer.reset();  // keep it ready
+            if (samplerRunning) {
+                stopSampler();
+                for (int i=0; i<SESSION_COUNT; i++) {
+                    if (sessions[i]->streaming)
+                        drainSamples(*sessions[i], i);
+                }
+            }
+            for (int i=0; i<SESSION_COUNT; i++)
+                flushStreamBatch(*sessions[i]);
+        }
+        if (idle) {
+            // Waiting for a motion trigger with no log clock running and no
+            // host: stop mode until the accelerometer INT1 wakes us
+            __disable_irq();
+            if (currentState == LOG_ACC_STATE && motionArmed && !logArmed && !motionTriggered && !webUSB.configured())
+                deepsleep();
+            else
+                sleep();
+            __enable_irq();
         }
-
-
-        // if(webUSB.read(rbuf_cdc, &read_size_cdc, true)) {
-        //     rbuf_cdc[read_size_cdc] = 0;
-        //     webUSB.write(rbuf_cdc, read_size_cdc);
-        // }
     }
 }
@@ -0,0 +1,52 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+// Minimal test assertions: count and report failures, keep going
+
+static int checkFailures = 0;
+static int checkCount = 0;
+
+#define CHECK(cond) do { \
+    checkCount++; \
+    if (!(cond)) { \
+        checkFailures++; \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    checkCount++; \
+    long long check_a = (long long)(a), check_b = (long long)(b); \
+    if (check_a != check_b) { \
+        checkFailures++; \
+        fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", \
+                __FILE__, __LINE__, #a, #b, check_a, check_b); \
+    } \
+} while (0)
+
+// Return from main()
+static inline int checkResult(const char* name) {
+    printf("%s: %d checks, %d failed\n", name, checkCount, checkFailures);
+    return checkFailures ? 1 : 0;
+}
+
+#endif
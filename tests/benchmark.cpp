@@ -0,0 +1,163 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+// Throughput benchmark on the simulated board: per protocol mode the
+// bytes per sample, USB packets per second and worst command latency,
+// and the time to download a full log as text and as binary chunks.
+// Writes JSON to the file given, or stdout, for comparing firmware
+// versions. Times are simulated, with SIM_RECEIVE_STEP_US resolution
+// on the host side; the on-target cycle counts come from GETBEN.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "Sim.h"
+#include "Check.h"
+
+int firmwareMain();
+
+#define WEBUSB false
+#define STREAM_US 10000000      // Streaming time per mode
+#define LATENCY_PROBES 20       // Commands timed while streaming
+#define PACKET_US 100           // Host time per IN packet
+
+#if defined(TARGET_KL25Z)
+#define TARGET_NAME "KL25Z"
+#else
+#define TARGET_NAME "KL46Z"
+#endif
+
+struct Mode {
+    const char* name;
+    const char* setup;
+    int rate;
+};
+
+static const Mode modes[] = {
+    { "json", "{'SETRTE':100}{'STRACC':1}{'STRTCH':1}", 100 },
+    { "jsonbatch", "{'SETRTE':100}{'SETBAT':8}{'STRACC':1}{'STRTCH':1}", 100 },
+    { "binary", "{'SETRTE':100}{'STRBIN':1}{'STRACC':1}{'STRTCH':1}", 100 },
+    { "binary400", "{'SETRTE':400}{'STRBIN':1}{'STRACC':1}{'STRTCH':1}", 400 },
+};
+
+static long long jsonValue(const std::string& text, const char* name) {
+    size_t i = text.find(name);
+    return i == std::string::npos ? -1 : atoll(text.c_str() + i + strlen(name));
+}
+
+// Run a command with an id, returns the reply and the simulated time to
+// its Ack
+static std::string command(const char* text, int id, uint32_t* us, uint32_t timeoutUs) {
+    char request[96], ack[64];
+    snprintf(request, sizeof(request), "{%s,'id':%d}", text, id);
+    snprintf(ack, sizeof(ack), "\"id\":%d,\"status\":\"ok\"}", id);
+    simUsbTake(WEBUSB);
+    uint64_t start = simTime();
+    simUsbSend(WEBUSB, request);
+    CHECK(simRunUntilReceived(WEBUSB, ack, timeoutUs));
+    if (us)
+        *us = simTime() - start;
+    return simUsbTake(WEBUSB);
+}
+
+static void benchMode(FILE* out, const Mode& mode, bool last) {
+    simUsbSend(WEBUSB, mode.setup);
+    simRun(100000);
+    command("'RSTSTS':1", 1, 0, 100000);
+
+    // Commands arrive at odd times against the sample clock
+    uint32_t worst = 0;
+    for (int i=0; i<LATENCY_PROBES; i++) {
+        uint32_t us;
+        simRun(STREAM_US / LATENCY_PROBES - 3000 + i * 137);
+        command("'NOTIFY':0", 2, &us, 1000000);
+        if (us > worst)
+            worst = us;
+    }
+    std::string status = command("'GETSTS':1", 3, 0, 1000000);
+    simUsbSend(WEBUSB, "{'SETIDL':1}");
+    simRun(100000);
+
+    long long samples = jsonValue(status, "\"samples\":");
+    long long bytes = jsonValue(status, "\"usbbytes\":");
+    long long packets = jsonValue(status, "\"usbpackets\":");
+    long long elapsed = jsonValue(status, "\"elapsed\":");
+    size_t stat = status.find("\"command\":");
+    long long commandMax = stat == std::string::npos ? -1 : jsonValue(status.substr(stat), "\"max\":");
+    CHECK(samples > 0 && bytes > 0 && packets > 0 && elapsed > 0 && commandMax >= 0);
+    if (samples <= 0 || elapsed <= 0)
+        return;
+
+    fprintf(out, "  {\"name\":\"%s\",\"rate\":%d,\"samples\":%lld,\"bytespersample\":%.1f,"
+            "\"packetspersec\":%.1f,\"commandlatencymax\":%u,\"commandhandlingmax\":%lld}%s\n",
+            mode.name, mode.rate, samples, (double)bytes / samples,
+            packets * 1e6 / elapsed, worst, commandMax, last ? "" : ",");
+}
+
+// Fill the log at 100 Hz, then download it both ways
+static void benchLog(FILE* out) {
+    simUsbSend(WEBUSB, "{'NOTIFY':1}{'SETRTE':100}{'LOGACC':1}");
+    simRun(100000);
+    simSetTouch(30);
+    simRun(300000);
+    simSetTouch(0);
+    for (int i=0; i<3600 && !simRunUntilReceived(WEBUSB, "LoggingEnded", 0); i++)
+        simRun(1000000);
+    CHECK(simRunUntilReceived(WEBUSB, "LoggingEnded", 0));
+    simUsbSend(WEBUSB, "{'NOTIFY':0}");
+    simRun(100000);
+
+    uint32_t textUs, binUs, packets;
+    packets = simUsbPackets(WEBUSB);
+    std::string text = command("'GETLOG':1", 4, &textUs, 60000000);
+    uint32_t textPackets = simUsbPackets(WEBUSB) - packets;
+    packets = simUsbPackets(WEBUSB);
+    std::string bin = command("'GETBIN':1", 5, &binUs, 60000000);
+    uint32_t binPackets = simUsbPackets(WEBUSB) - packets;
+    long long samples = jsonValue(bin, "\"samples\":");
+    CHECK(samples > 0 && binPackets < textPackets);
+
+    fprintf(out, " \"log\":{\"samples\":%lld,\n"
+            "  \"getlog\":{\"us\":%u,\"packets\":%u,\"bytes\":%u},\n"
+            "  \"getbin\":{\"us\":%u,\"packets\":%u,\"bytes\":%u}}\n",
+            samples, textUs, textPackets, (uint32_t)text.size(), binUs, binPackets, (uint32_t)bin.size());
+}
+
+int main(int argc, char** argv) {
+    FILE* out = argc > 1 ? fopen(argv[1], "w") : stdout;
+    if (!out) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    simBoot(firmwareMain);
+    simUsbConfigure();
+    simUsbSetDtr(WEBUSB, true);
+    simUsbSetPacketTime(PACKET_US);
+    simRun(100000);
+
+    fprintf(out, "{\"target\":\"%s\",\"packettime\":%d,\n \"modes\":[\n", TARGET_NAME, PACKET_US);
+    for (unsigned int i=0; i<sizeof(modes)/sizeof(modes[0]); i++)
+        benchMode(out, modes[i], i + 1 == sizeof(modes)/sizeof(modes[0]));
+    fprintf(out, " ],\n");
+    benchLog(out);
+    fprintf(out, "}\n");
+    if (out != stdout)
+        fclose(out);
+    return checkResult("benchmark");
+}
@@ -0,0 +1,127 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+// CicDecimator: the fixed-point filter against a double-precision CIC,
+// for every factor, through integrator wrap-around
+
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "CicDecimator.h"
+#include "Check.h"
+
+// Impulse response of a CIC_ORDER stage CIC, a boxcar of length factor
+// convolved with itself, normalised to unity gain at DC
+static std::vector<double> cicResponse(int factor) {
+    std::vector<double> h(1, 1.0);
+    for (int s=0; s<CIC_ORDER; s++) {
+        std::vector<double> next(h.size() + factor - 1, 0.0);
+        for (size_t i=0; i<h.size(); i++) {
+            for (int j=0; j<factor; j++)
+                next[i + j] += h[i];
+        }
+        h = next;
+    }
+    for (size_t i=0; i<h.size(); i++)
+        h[i] /= pow((double)factor, CIC_ORDER);
+    return h;
+}
+
+// Runs input through the decimator and the reference FIR, which starts
+// from the same all-zero history, and returns the largest difference.
+// The fixed-point output is rounded, so it may be off by half a count.
+static double maxError(int factor, const std::vector<int16_t>& input, int* outputs) {
+    CicDecimator cic;
+    std::vector<double> h = cicResponse(factor);
+    double worst = 0;
+
+    cic.setFactor(factor);
+    *outputs = 0;
+    for (size_t n=0; n<input.size()/3; n++) {
+        int16_t out[3];
+        if (!cic.push(&input[3*n], out))
+            continue;
+        for (int a=0; a<3; a++) {
+            double y = 0;
+            for (size_t j=0; j<h.size() && j<=n; j++)
+                y += h[j] * input[3*(n-j) + a];
+            worst = fabs(out[a] - y) > worst ? fabs(out[a] - y) : worst;
+        }
+        (*outputs)++;
+    }
+    return worst;
+}
+
+static void testAgainstReference() {
+    for (int factor=1; factor<=CIC_MAX_FACTOR; factor*=2) {
+        // Full-scale 14-bit noise, long enough for the integrators to wrap
+        std::vector<int16_t> noise;
+        for (int i=0; i<3*20000; i++)
+            noise.push_back(rand() % 16384 - 8192);
+        int outputs;
+        CHECK(maxError(factor, noise, &outputs) <= 0.5 + 1e-9);
+        CHECK_EQ(outputs, 20000 / factor);
+
+        // Full-scale steps, the largest values the combs must undo
+        std::vector<int16_t> steps;
+        for (int i=0; i<3*2000; i++)
+            steps.push_back((i / 3 / 37) & 1 ? 8191 : -8192);
+        CHECK(maxError(factor, steps, &outputs) <= 0.5 + 1e-9);
+    }
+}
+
+// The filter's zeros sit on multiples of the output rate, so a tone
+// there, which would alias to DC, is removed; DC itself passes
+static void testResponse() {
+    for (int factor=2; factor<=CIC_MAX_FACTOR; factor*=2) {
+        CicDecimator cic;
+        cic.setFactor(factor);
+        int largest = 0, outputs = 0, dc = 0;
+        for (int n=0; n<100*factor; n++) {
+            int16_t in[3], out[3];
+            in[0] = (int16_t)lrint(4000 * sin(2 * M_PI * n / factor));
+            in[1] = 1234;
+            in[2] = -4096;
+            if (!cic.push(in, out) || ++outputs <= CIC_ORDER)
+                continue;  // Settling
+            largest = abs(out[0]) > largest ? abs(out[0]) : largest;
+            if (out[1] == 1234 && out[2] == -4096)
+                dc++;
+        }
+        CHECK(largest <= 1);
+        CHECK_EQ(dc, outputs - CIC_ORDER);
+    }
+}
+
+static void testFactors() {
+    CicDecimator cic;
+    CHECK(!cic.setFactor(0));
+    CHECK(!cic.setFactor(3));
+    CHECK(!cic.setFactor(2 * CIC_MAX_FACTOR));
+    CHECK_EQ(cic.factor(), 1);
+    CHECK(cic.setFactor(8));
+    CHECK(!cic.setFactor(12));
+    CHECK_EQ(cic.factor(), 8);
+}
+
+int main() {
+    srand(1);
+    testAgainstReference();
+    testResponse();
+    testFactors();
+    return checkResult("cic_decimator");
+}
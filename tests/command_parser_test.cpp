@@ -0,0 +1,267 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+// CommandParser: the protocol forms, commands split at any byte, and
+// random input, which must never leave a malformed command or keep the
+// parser from recovering
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "CommandParser.h"
+#include "CommandTable.h"
+#include "Check.h"
+
+// Feeds text, collects the commands and counts the errors
+struct Parsed {
+    std::vector<Command> commands;
+    int errors;
+};
+
+static Parsed parse(CommandParser* p, const char* text, size_t len) {
+    Parsed r;
+    r.errors = 0;
+    for (size_t i=0; i<len; i++) {
+        PARSE_RESULT result = p->feed(text[i]);
+        if (result == PARSE_COMMAND)
+            r.commands.push_back(*p->command());
+        else if (result == PARSE_ERROR)
+            r.errors++;
+    }
+    return r;
+}
+
+static Parsed parse(const char* text) {
+    CommandParser p;
+    return parse(&p, text, strlen(text));
+}
+
+// A command the firmware can act on: terminated strings within bounds,
+// a value count that fits the type and a key packed from the name
+static bool validCommand(const Command& c) {
+    size_t nameLen = strnlen(c.name, sizeof(c.name));
+    size_t strLen = strnlen(c.str, sizeof(c.str));
+    if (nameLen > CMD_NAME_LENGTH || strLen > CMD_MAX_STRING)
+        return false;
+    if (c.valueCount < 0 || c.valueCount > CMD_MAX_VALUES)
+        return false;
+    switch (c.type) {
+        case CMD_VALUE_NONE: case CMD_VALUE_STRING:
+            if (c.valueCount != 0)
+                return false;
+            break;
+        case CMD_VALUE_INT:
+            if (c.valueCount != 1)
+                return false;
+            break;
+        case CMD_VALUE_ARRAY:
+            break;
+        default:
+            return false;
+    }
+    uint64_t key = 0;
+    for (size_t i=0; i<nameLen; i++)
+        key = (key << 8) | (uint8_t)c.name[i];
+    return (c.key >> 8 * (CMD_NAME_LENGTH - nameLen)) == key;
+}
+
+// Field by field, the unused parts of a Command hold stale bytes
+static bool sameCommand(const Command& a, const Command& b) {
+    if (strcmp(a.name, b.name) || a.key != b.key || a.type != b.type ||
+        a.valueCount != b.valueCount || a.hasId != b.hasId || (a.hasId && a.id != b.id))
+        return false;
+    if (a.type == CMD_VALUE_STRING && strcmp(a.str, b.str))
+        return false;
+    return !memcmp(a.values, b.values, a.valueCount * sizeof(a.values[0]));
+}
+
+static void testForms() {
+    Parsed r = parse("{'SETRTE':100}");
+    CHECK_EQ(r.commands.size(), 1);
+    CHECK(!strcmp(r.commands[0].name, "SETRTE"));
+    CHECK(r.commands[0].key == CMD_KEY('S','E','T','R','T','E'));
+    CHECK_EQ(r.commands[0].type, CMD_VALUE_INT);
+    CHECK_EQ(r.commands[0].values[0], 100);
+    CHECK(!r.commands[0].hasId);
+
+    r = parse(" { \"SETRGB\" : [ 255, 0,-1 ] } ");
+    CHECK_EQ(r.commands.size(), 1);
+    CHECK_EQ(r.commands[0].type, CMD_VALUE_ARRAY);
+    CHECK_EQ(r.commands[0].valueCount, 3);
+    CHECK_EQ(r.commands[0].values[0], 255);
+    CHECK_EQ(r.commands[0].values[2], -1);
+
+    r = parse("{'SETLCD':'Hi'}");
+    CHECK_EQ(r.commands.size(), 1);
+    CHECK_EQ(r.commands[0].type, CMD_VALUE_STRING);
+    CHECK(!strcmp(r.commands[0].str, "Hi"));
+
+    // The id before or after the command, other keys skipped
+    r = parse("{'id':7,'GETINF':1}{'STRACC':0,'x':[1,2],'id':-3}");
+    CHECK_EQ(r.commands.size(), 2);
+    CHECK(!strcmp(r.commands[0].name, "GETINF"));
+    CHECK(r.commands[0].hasId);
+    CHECK_EQ(r.commands[0].id, 7);
+    CHECK(!strcmp(r.commands[1].name, "STRACC"));
+    CHECK_EQ(r.commands[1].values[0], 0);
+    CHECK_EQ(r.commands[1].id, -3);
+
+    // Short names are padded, long names, strings and arrays truncated
+    r = parse("{'AB':1}{'LONGNAME':1}{'SETLCD':'0123456789'}{'SENRTE':[1,2,3,4,5,6]}");
+    CHECK_EQ(r.commands.size(), 4);
+    CHECK(r.commands[0].key == CMD_KEY('A','B',0,0,0,0));
+    CHECK(!strcmp(r.commands[1].name, "LONGNA"));
+    CHECK(r.commands[1].key == CMD_KEY('L','O','N','G','N','A'));
+    CHECK(!strcmp(r.commands[2].str, "01234567"));
+    CHECK_EQ(r.commands[3].valueCount, CMD_MAX_VALUES);
+    CHECK_EQ(r.commands[3].values[3], 4);
+
+    // Huge numbers saturate instead of wrapping
+    r = parse("{'SETRTE':99999999999999999999}");
+    CHECK_EQ(r.commands.size(), 1);
+    CHECK(r.commands[0].values[0] > 100000000);
+
+    // Malformed objects are reported once and skipped
+    r = parse("{SETRTE:1}{'SETRTE' 1}{'SETRTE':x}{'SETRTE':[1,x]}{'SETRTE':-}{'GETINF':1}");
+    CHECK_EQ(r.errors, 5);
+    CHECK_EQ(r.commands.size(), 1);
+    CHECK(!strcmp(r.commands[0].name, "GETINF"));
+}
+
+// A packet boundary can fall on any byte, and so can the end of a
+// read: splitting the stream anywhere gives the same commands
+static void testSplit() {
+    const char* text = "{'SETRTE':100}{'id':1,'SETRGB':[1,2,3]}{'SETLCD':'abc','id':2}{'GETINF':1}";
+    size_t len = strlen(text);
+    Parsed whole = parse(text);
+    CHECK_EQ(whole.commands.size(), 4);
+
+    for (size_t a=0; a<=len; a++) {
+        for (size_t b=a; b<=len; b++) {
+            CommandParser p;
+            Parsed r1 = parse(&p, text, a);
+            Parsed r2 = parse(&p, text + a, b - a);
+            Parsed r3 = parse(&p, text + b, len - b);
+            r1.commands.insert(r1.commands.end(), r2.commands.begin(), r2.commands.end());
+            r1.commands.insert(r1.commands.end(), r3.commands.begin(), r3.commands.end());
+            bool same = r1.commands.size() == whole.commands.size();
+            for (size_t i=0; same && i<r1.commands.size(); i++)
+                same = sameCommand(r1.commands[i], whole.commands[i]);
+            CHECK(same);
+        }
+    }
+}
+
+// Random bytes and mangled commands: every command that comes out is
+// well formed, and a few closing characters always bring the parser
+// back to the start of an object
+#define FUZZ_ROUNDS 20000
+
+static void testFuzz() {
+    static const char* const pieces[] = {
+        "{", "}", "[", "]", ":", ",", "'", "\"", "-", "0", "12", " ",
+        "'id'", "'SETRTE'", "\"SETRGB\"", "'x'", "99999999999", "'abcdefghij'",
+    };
+    // From any state: closes a key or string with either quote, then
+    // ends the object
+    static const char resync[] = "'\"}'\"}";
+    CommandParser p;
+    int bad = 0;
+    int lost = 0;
+
+    for (int round=0; round<FUZZ_ROUNDS; round++) {
+        std::string noise;
+        int n = rand() % 64;
+        for (int i=0; i<n; i++) {
+            if (rand() & 1)
+                noise += (char)(rand() & 0xFF);
+            else
+                noise += pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+        }
+        Parsed r = parse(&p, noise.data(), noise.size());
+        for (size_t i=0; i<r.commands.size(); i++) {
+            if (!validCommand(r.commands[i]))
+                bad++;
+        }
+
+        parse(&p, resync, sizeof(resync) - 1);
+        r = parse(&p, "{'GETSTS':1,'id':5}", 19);
+        if (r.commands.size() != 1 || r.commands[0].key != CMD_KEY('G','E','T','S','T','S') ||
+            r.commands[0].id != 5)
+            lost++;
+    }
+    CHECK_EQ(bad, 0);
+    CHECK_EQ(lost, 0);
+}
+
+// Throughput on the host, for comparison between parser changes
+static void benchmark() {
+    const char* text = "{'SETRTE':100,'id':1}{'SETRGB':[255,128,0]}{'SETLCD':'TEST'}";
+    size_t len = strlen(text);
+    CommandParser p;
+    long commands = 0;
+    clock_t start = clock();
+
+    for (int i=0; i<200000; i++) {
+        for (size_t j=0; j<len; j++) {
+            if (p.feed(text[j]) == PARSE_COMMAND)
+                commands++;
+        }
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    CHECK_EQ(commands, 3 * 200000);
+    if (seconds > 0)
+        printf("command_parser: %.0f commands/s\n", commands / seconds);
+}
+
+static void nop(const Command*) {}
+
+// Sorted tables pass, a swap or a name repeated in its first six
+// characters does not, and every entry of a sorted table is found
+static void testTableOrder() {
+    const CommandEntry sorted[] = {
+        { COMMAND('G','E','T','I','N','F'), CMD_ARG_ANY, nop, "" },
+        { COMMAND('S','E','T','R','T','E'), CMD_ARG_INT, nop, "" },
+        { COMMAND('S','T','O','P','L','O'), CMD_ARG_ANY, nop, "" },
+    };
+    const CommandEntry swapped[] = {
+        { COMMAND('S','E','T','R','T','E'), CMD_ARG_INT, nop, "" },
+        { COMMAND('G','E','T','I','N','F'), CMD_ARG_ANY, nop, "" },
+    };
+    const CommandEntry repeated[] = {
+        { COMMAND('S','T','O','P','L','O'), CMD_ARG_ANY, nop, "" },
+        { COMMAND('S','T','O','P','L','O'), CMD_ARG_ANY, nop, "" },
+    };
+    CHECK(commandTableSorted(sorted, COMMAND_COUNT(sorted)));
+    CHECK(commandTableSorted(sorted, 1));
+    CHECK(!commandTableSorted(swapped, COMMAND_COUNT(swapped)));
+    CHECK(!commandTableSorted(repeated, COMMAND_COUNT(repeated)));
+    for (unsigned int i=0; i<COMMAND_COUNT(sorted); i++)
+        CHECK(findCommand(sorted, COMMAND_COUNT(sorted), sorted[i].key) == &sorted[i]);
+}
+
+int main() {
+    srand(1);
+    testTableOrder();
+    testForms();
+    testSplit();
+    testFuzz();
+    benchmark();
+    return checkResult("command_parser");
+}
@@ -0,0 +1,200 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+// DeltaLog: lossless for any input, stops cleanly when full, and small
+// for accelerometer-like data
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "DeltaLog.h"
+#include "Check.h"
+
+static bool roundTrip(const std::vector<int16_t>& samples, uint32_t bufSize) {
+    std::vector<uint8_t> buf(bufSize);
+    DeltaLog log;
+    uint32_t n = samples.size() / 3;
+
+    log.begin(&buf[0], bufSize);
+    for (uint32_t i=0; i<n; i++) {
+        if (!log.append(&samples[3*i]))
+            return false;
+    }
+    log.finish();
+    if (log.samples() != n || log.bytesUsed() > bufSize)
+        return false;
+
+    log.rewind();
+    int16_t xyz[3];
+    for (uint32_t i=0; i<n; i++) {
+        if (!log.next(xyz) || memcmp(xyz, &samples[3*i], sizeof(xyz)))
+            return false;
+    }
+    return !log.next(xyz);
+}
+
+static void testRoundTrip() {
+    // Every partial block length, full-scale jumps and a slow walk
+    for (uint32_t n=0; n<=3*DELTA_LOG_BLOCK + 1; n++) {
+        std::vector<int16_t> noise, extremes, walk;
+        int16_t pos[3] = {0, 0, 4096};
+        for (uint32_t i=0; i<n; i++) {
+            for (int a=0; a<3; a++) {
+                noise.push_back((int16_t)rand());
+                extremes.push_back((i + a) & 1 ? 32767 : -32768);
+                pos[a] += rand() % 7 - 3;
+                walk.push_back(pos[a]);
+            }
+        }
+        CHECK(roundTrip(noise, 4096));
+        CHECK(roundTrip(extremes, 4096));
+        CHECK(roundTrip(walk, 4096));
+    }
+}
+
+// Filling up: append refuses once a worst case block might not fit,
+// and everything accepted reads back
+static void testFull() {
+    uint8_t buf[256];
+    DeltaLog log;
+    std::vector<int16_t> samples;
+    uint32_t accepted = 0;
+
+    for (int i=0; i<3*10000; i++)
+        samples.push_back((int16_t)rand());
+    log.begin(buf, sizeof(buf));
+    while (accepted < 10000 && log.append(&samples[3*accepted]))
+        accepted++;
+    CHECK(accepted > 0 && accepted < 10000);
+    CHECK_EQ(accepted % DELTA_LOG_BLOCK, 0);
+    log.finish();
+    CHECK(log.bytesUsed() <= sizeof(buf));
+
+    log.rewind();
+    int16_t xyz[3];
+    bool same = true;
+    for (uint32_t i=0; i<accepted; i++) {
+        if (!log.next(xyz) || memcmp(xyz, &samples[3*i], sizeof(xyz)))
+            same = false;
+    }
+    CHECK(same);
+    CHECK(!log.next(xyz));
+}
+
+// A board at rest with a little noise: a few bits per axis
+static void testCompression() {
+    std::vector<int16_t> samples;
+    for (int i=0; i<8000; i++) {
+        samples.push_back(20 + rand() % 5);
+        samples.push_back(-15 + rand() % 5);
+        samples.push_back(4090 + rand() % 9);
+    }
+    std::vector<uint8_t> buf(8000 * 6);
+    DeltaLog log;
+    log.begin(&buf[0], buf.size());
+    for (int i=0; i<8000; i++)
+        log.append(&samples[3*i]);
+    log.finish();
+    CHECK(log.bytesUsed() * 3 < 8000 * 6);  // At least 3x smaller than raw
+    CHECK(roundTrip(samples, buf.size()));
+}
+
+// A recorded trace as the log sees it at 100 Hz, each us,x,y,z row held
+// until the next like the simulated MMA8451Q does
+static bool loadTrace(const char* path, std::vector<int16_t>* samples) {
+    FILE* f = fopen(path, "r");
+    char line[128];
+    std::vector<unsigned long long> times;
+    std::vector<int16_t> rows;
+
+    if (!f)
+        return false;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long us;
+        int x, y, z;
+        if (sscanf(line, "%llu,%d,%d,%d", &us, &x, &y, &z) != 4)
+            continue;  // Header or comment
+        times.push_back(us);
+        rows.push_back(x);
+        rows.push_back(y);
+        rows.push_back(z);
+    }
+    fclose(f);
+    if (times.empty())
+        return false;
+    size_t row = 0;
+    for (unsigned long long us = times[0]; us < times.back() + 100000; us += 10000) {
+        while (row + 1 < times.size() && times[row + 1] <= us)
+            row++;
+        samples->insert(samples->end(), &rows[3*row], &rows[3*row] + 3);
+    }
+    return true;
+}
+
+// Compression ratio and encode/decode time per sample on real movement
+#define TRACE_REPEATS 2000
+
+static void testTrace(const char* path) {
+    std::vector<int16_t> samples;
+    CHECK(loadTrace(path, &samples));
+    if (samples.empty())
+        return;
+    uint32_t n = samples.size() / 3;
+    std::vector<uint8_t> buf(n * 6);
+    CHECK(roundTrip(samples, buf.size()));
+
+    DeltaLog log;
+    clock_t start = clock();
+    for (int r=0; r<TRACE_REPEATS; r++) {
+        log.begin(&buf[0], buf.size());
+        for (uint32_t i=0; i<n; i++)
+            log.append(&samples[3*i]);
+        log.finish();
+    }
+    double appendSeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    int16_t xyz[3];
+    int32_t sum = 0;
+    start = clock();
+    for (int r=0; r<TRACE_REPEATS; r++) {
+        log.rewind();
+        while (log.next(xyz))
+            sum += xyz[0];
+    }
+    double nextSeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    CHECK(sum != 0);
+
+    double ratio = (double)(n * 6) / log.bytesUsed();
+    CHECK(ratio > 4);  // Mostly still, the steps cost a block each
+    printf("delta_log: %s, %u samples, %u bytes, ratio %.1f, append %.1f ns/sample, next %.1f ns/sample\n",
+           path, n, log.bytesUsed(), ratio,
+           appendSeconds * 1e9 / ((double)n * TRACE_REPEATS),
+           nextSeconds * 1e9 / ((double)n * TRACE_REPEATS));
+}
+
+int main(int argc, char** argv) {
+    srand(1);
+    testRoundTrip();
+    testFull();
+    testCompression();
+    if (argc > 1)
+        testTrace(argv[1]);
+    return checkResult("delta_log");
+}
@@ -0,0 +1,931 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+// The firmware's main loop on the simulated board, driven over USB like
+// the WebUSB page and a terminal would
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "ByteOrder.h"
+#include "LogChunk.h"
+#include "StreamFrame.h"
+#include "WebUSBCDC.h"
+#include "Sim.h"
+#include "Check.h"
+
+int firmwareMain();
+extern "C" void* _sbrk(int incr);
+
+#define WEBUSB false
+#define CDC true
+
+// Sequence numbers of the JSON StreamData frames, and how many were skipped
+static int seqGaps(const std::string& stream, int* frames) {
+    int expected = -1, gaps = 0;
+    *frames = 0;
+    for (size_t i = stream.find("\"seq\":"); i != std::string::npos; i = stream.find("\"seq\":", i + 1)) {
+        int seq = atoi(stream.c_str() + i + 6);
+        if (expected >= 0 && seq != (expected & 0xffff))
+            gaps++;
+        expected = seq + 1;
+        (*frames)++;
+    }
+    return gaps;
+}
+
+static int statusValue(const std::string& status, const char* name) {
+    size_t i = status.find(name);
+    return i == std::string::npos ? -1 : atoi(status.c_str() + i + strlen(name));
+}
+
+static int countOf(const std::string& s, const char* needle) {
+    int n = 0;
+    for (size_t i = s.find(needle); i != std::string::npos; i = s.find(needle, i + 1))
+        n++;
+    return n;
+}
+
+static void testInfo() {
+    simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'GETINF':1}");
+    CHECK(simRunUntilReceived(WEBUSB, "]}", 100000));
+    std::string reply = simUsbTake(WEBUSB);
+    CHECK(reply.find("\"datatype\":\"HardwareInfo\"") != std::string::npos);
+    CHECK(reply.find("\"logcapacity\":") != std::string::npos);
+
+    // The arena was claimed from the heap: the heap may still grow, but
+    // not as far as the log, and the log got the rest, past the two
+    // 64-byte receive buffers
+    void* heap = _sbrk(0);
+    CHECK(_sbrk(4096) == (void*)-1);
+    CHECK(_sbrk(0) == heap);
+#if defined(TARGET_KL25Z)
+    CHECK_EQ(statusValue(reply, "\"logcapacity\":"), (8192 - 2*64) / 6);
+#else
+    CHECK_EQ(statusValue(reply, "\"logcapacity\":"), (24576 - 2*64) / 6);
+#endif
+}
+
+// Acks of pipelined commands, in order, in one go
+static void testAcks() {
+    simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'SETRTE':20,'id':1}{'NOSUCH':1,'id':2}{'SETRTE':7000,'id':3}");
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":3,\"status\":\"invalid\"}", 100000));
+    std::string reply = simUsbTake(WEBUSB);
+    size_t a1 = reply.find("{\"datatype\":\"Ack\",\"id\":1,\"status\":\"ok\"}");
+    size_t a2 = reply.find("{\"datatype\":\"Ack\",\"id\":2,\"status\":\"unknown\"}");
+    size_t a3 = reply.find("{\"datatype\":\"Ack\",\"id\":3,\"status\":\"invalid\"}");
+    CHECK(a1 != std::string::npos && a2 != std::string::npos && a3 != std::string::npos);
+    CHECK(a1 < a2 && a2 < a3);
+}
+
+// Every command reaches its own handler: a value on either side of the
+// handler's own limit gets ok and invalid, or the reply only it sends.
+// The help text lists exactly the probed commands, sorted per table.
+struct Probe {
+    const char* command;
+    const char* status;
+    const char* reply;  // Expected in the reply, or 0
+};
+
+static const Probe probes[] = {
+    { "'GETBEN':1", "ok", "\"datatype\":\"Benchmark\"" },
+    { "'GETBIN':1", "ok", "\"datatype\":\"AccelerometerLogBinary\"" },
+    { "'GETINF':1", "ok", "\"datatype\":\"HardwareInfo\"" },
+    { "'GETLOG':1", "ok", "\"datatype\":\"AccelerometerLog\"" },
+    { "'GETSTS':1", "ok", "\"datatype\":\"Status\"" },
+    { "'RSTSTS':1", "ok", 0 },
+    { "'NOTIFY':'on'", "invalid", 0 },
+    { "'NOTIFY':0", "ok", 0 },
+    { "'SENRTE':[0,10]", "ok", 0 },
+    { "'SENRTE':[9,10]", "invalid", 0 },
+    { "'SETBAT':32", "ok", 0 },
+    { "'SETBAT':33", "invalid", 0 },
+    { "'SETCMP':1", "ok", 0 },
+    { "'SETCMP':'on'", "invalid", 0 },
+    { "'SETCMP':0", "ok", 0 },
+    { "'SETDBD':[1,10]", "ok", 0 },
+    { "'SETDBD':[9,10]", "invalid", 0 },
+    { "'SETDBD':[1,0]", "ok", 0 },
+    { "'SETDRP':1", "ok", 0 },
+    { "'SETDRP':[1]", "invalid", 0 },
+    { "'SETFLT':4", "ok", 0 },
+    { "'SETFLT':3", "invalid", 0 },
+    { "'SETFLT':1", "ok", 0 },
+    { "'SETKEY':60000", "ok", 0 },
+    { "'SETKEY':60001", "invalid", 0 },
+    { "'SETKEY':0", "ok", 0 },
+    { "'SETPRE':0", "ok", 0 },
+    { "'SETPRE':100000", "invalid", 0 },
+    { "'SETRTE':100", "ok", 0 },
+    { "'SETRTE':101", "invalid", 0 },
+    { "'STRACC':'on'", "invalid", 0 },
+    { "'STRACC':0", "ok", 0 },
+    { "'STRBIN':'on'", "invalid", 0 },
+    { "'STRBIN':0", "ok", 0 },
+    { "'STRTCH':'on'", "invalid", 0 },
+    { "'STRTCH':0", "ok", 0 },
+    { "'TAILOG':'on'", "invalid", 0 },
+    { "'TAILOG':-1", "ok", 0 },
+    { "'SETTRG':[1,8001,1]", "ok", 0 },
+    { "'SETTRG':[1,8002,1]", "invalid", 0 },
+    { "'LOGACC':1", "ok", 0 },
+    { "'GETLOG':1", "busy", "\"data\":\"Logging in progress.\"" },
+    { "'STOPLOG':1", "ok", 0 },
+    { "'SETTRG':0", "ok", 0 },
+    { "'SETIDL':1", "ok", 0 },
+#if defined(TARGET_KL25Z)
+    { "'SETRGB':[1,2,3]", "ok", 0 },
+    { "'SETRGB':[1,2]", "invalid", 0 },
+    { "'SETRGB':[0,0,0]", "ok", 0 },
+#elif defined(TARGET_KL46Z)
+    { "'SETLCD':'ab'", "ok", 0 },
+    { "'SETLCD':[1]", "invalid", 0 },
+    { "'STRLGT':'on'", "invalid", 0 },
+    { "'STRLGT':0", "ok", 0 },
+    { "'STRMAG':'on'", "invalid", 0 },
+    { "'STRMAG':0", "ok", 0 },
+#endif
+    { "'SETRGX':1", "unknown", 0 },
+    { "'GETIN':1", "unknown", 0 },
+};
+
+static void testCommandTable() {
+    std::string probed;
+    simUsbTake(WEBUSB);
+    for (unsigned int i=0; i<sizeof(probes) / sizeof(probes[0]); i++) {
+        char text[64], ack[80];
+        snprintf(text, sizeof(text), "{%s,'id':%u}", probes[i].command, 100 + i);
+        snprintf(ack, sizeof(ack), "{\"datatype\":\"Ack\",\"id\":%u,\"status\":\"%s\"}", 100 + i, probes[i].status);
+        simUsbSend(WEBUSB, text);
+        bool acked = simRunUntilReceived(WEBUSB, ack, 2000000);
+        std::string reply = simUsbTake(WEBUSB);
+        if (!acked || (probes[i].reply && reply.find(probes[i].reply) == std::string::npos))
+            fprintf(stderr, "%s: %s\n", text, reply.substr(0, 80).c_str());
+        CHECK(acked);
+        CHECK(!probes[i].reply || reply.find(probes[i].reply) != std::string::npos);
+        if (strcmp(probes[i].status, "unknown"))
+            probed += std::string(probes[i].command + 1, 6) + " ";
+    }
+
+    // An unknown command without an id gets the help text
+    simUsbSend(WEBUSB, "{'HELP':1}");
+    CHECK(simRunUntilReceived(WEBUSB, "empirikit.com", 1000000));
+    std::string help = simUsbTake(WEBUSB);
+    CHECK(help.find("STOPLO => ") != std::string::npos);
+    CHECK(help.find("{'STOPLOG':1} is STOPLO") != std::string::npos);
+    std::string last;
+    int names = 0, unsorted = 0, unprobed = 0;
+    for (size_t i = help.find(" => "); i != std::string::npos; i = help.find(" => ", i + 1)) {
+        if (i < 7 || help[i - 7] != '"' || help.compare(i - 4, 4, "\"CMD") == 0)
+            continue;  // The heading
+        std::string name = help.substr(i - 6, 6);
+        // The target table starts over
+        if (name <= last && name != "SETLCD" && name != "SETRGB")
+            unsorted++;
+        if (probed.find(name + " ") == std::string::npos)
+            unprobed++;
+        last = name;
+        names++;
+    }
+#if defined(TARGET_KL25Z)
+    CHECK_EQ(names, 25);
+#else
+    CHECK_EQ(names, 27);
+#endif
+    CHECK_EQ(unsorted, 0);
+    CHECK_EQ(unprobed, 0);
+}
+
+// Ten simulated seconds at 50 Hz, every sample in sequence
+static void testStream() {
+    simUsbSend(WEBUSB, "{'SETRTE':50}{'STRACC':1}");
+    simRun(10000000);
+    simUsbSend(WEBUSB, "{'STRACC':0}");
+    simRun(100000);
+    std::string stream = simUsbTake(WEBUSB);
+
+    int frames;
+    CHECK_EQ(seqGaps(stream, &frames), 0);
+    CHECK(frames >= 495 && frames <= 505);
+}
+
+// STRBIN frames walk back to back, none lost or torn across packets
+static void testBinaryStream() {
+    simUsbSend(WEBUSB, "{'SETRTE':100}{'STRBIN':1}{'STRTCH':1}{'STRACC':1}");
+    simRun(100000);
+    simUsbTake(WEBUSB);
+    simRun(5000000);
+    simUsbSend(WEBUSB, "{'STRACC':0}{'STRTCH':0}{'STRBIN':0}");
+    simRun(100000);
+    std::string stream = simUsbTake(WEBUSB);
+
+    const uint8_t* p = (const uint8_t*)stream.data();
+    uint32_t pos = 0, len = stream.size();
+    int frames = 0;
+    bool inOrder = true;
+    StreamFrame frame, last;
+    while (pos < len) {
+        uint32_t used = decodeStreamFrame(p + pos, len - pos, &frame);
+        if (!used)
+            break;
+        if (frames && (frame.seq != (uint16_t)(last.seq + 1) || frame.timestamp - last.timestamp != 10000))
+            inOrder = false;
+        if ((frame.mask & (STREAM_FRAME_TOUCH | STREAM_FRAME_ACC)) != (STREAM_FRAME_TOUCH | STREAM_FRAME_ACC))
+            inOrder = false;
+        last = frame;
+        frames++;
+        pos += used;
+    }
+    CHECK_EQ(pos, len);
+    CHECK(frames >= 495 && frames <= 515);
+    CHECK(inOrder);
+}
+
+// 400 Hz through the accelerometer FIFO in bursts of 16, then rate
+// changes while streaming, each of which reprograms the FIFO
+static void testFifoStream() {
+    simUsbSend(WEBUSB, "{'SETRTE':400}{'STRBIN':1}{'STRACC':1}{'RSTSTS':1}");
+    simRun(100000);
+    simUsbTake(WEBUSB);
+    simRun(2000000);
+    std::string stream = simUsbTake(WEBUSB);
+
+    const uint8_t* p = (const uint8_t*)stream.data();
+    uint32_t pos = 0, len = stream.size();
+    int frames = 0;
+    bool inOrder = true;
+    StreamFrame frame, last;
+    while (pos < len) {
+        uint32_t used = decodeStreamFrame(p + pos, len - pos, &frame);
+        if (!used)
+            break;
+        if (frames && (frame.seq != (uint16_t)(last.seq + 1) || frame.timestamp - last.timestamp != 2500))
+            inOrder = false;
+        last = frame;
+        frames++;
+        pos += used;
+    }
+    CHECK_EQ(pos, len);
+    CHECK(frames >= 780 && frames <= 820);
+    CHECK(inOrder);
+
+    static const char* rates[] = {"{'SETRTE':50}", "{'SETRTE':800}", "{'SETRTE':100}", "{'SETRTE':200}"};
+    for (int i=0; i<4; i++) {
+        simUsbSend(WEBUSB, rates[i]);
+        simRun(500000);
+    }
+    CHECK(simUsbTake(WEBUSB).size() > 0);
+    simUsbSend(WEBUSB, "{'STRACC':0}{'STRBIN':0}");
+    simRun(100000);
+    simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'GETSTS':1}");
+    CHECK(simRunUntilReceived(WEBUSB, "]}}", 100000));
+    CHECK_EQ(statusValue(simUsbTake(WEBUSB), "\"fifooverflows\":"), 0);
+}
+
+// SENRTE: each sensor at its own rate in one stream, slower and faster
+// than the accelerometer, counted over ten seconds
+static void testSensorRates() {
+#if defined(TARGET_KL25Z)
+    simUsbSend(WEBUSB, "{'SETRTE':50}{'SENRTE':[0,100]}{'STRTCH':1}{'STRACC':1}");
+#else
+    simUsbSend(WEBUSB, "{'SETRTE':50}{'SENRTE':[0,100]}{'SENRTE':[2,20]}{'SENRTE':[3,5]}"
+                       "{'STRTCH':1}{'STRMAG':1}{'STRLGT':1}{'STRACC':1}");
+#endif
+    simRun(100000);
+    simUsbTake(WEBUSB);
+    simRun(10000000);
+    std::string stream = simUsbTake(WEBUSB);
+    int acc = countOf(stream, "\"accelerometerdata\":");
+    int touch = countOf(stream, "\"touchsensordata\":");
+    CHECK(acc >= 495 && acc <= 505);
+    CHECK(touch >= 990 && touch <= 1010);
+    CHECK_EQ(seqGaps(stream, &acc), 0);
+#if defined(TARGET_KL46Z)
+    int mag = countOf(stream, "\"magnetometerdata\":");
+    int light = countOf(stream, "\"lightsensordata\":");
+    CHECK(mag >= 198 && mag <= 202);
+    CHECK(light >= 49 && light <= 51);
+    simUsbSend(WEBUSB, "{'STRMAG':0}{'STRLGT':0}{'SENRTE':[2,0]}{'SENRTE':[3,0]}");
+#endif
+    simUsbSend(WEBUSB, "{'STRACC':0}{'STRTCH':0}{'SENRTE':[0,0]}");
+    simRun(100000);
+    simUsbTake(WEBUSB);
+}
+
+// The board at rest, x set by the test
+static int16_t restX = 100;
+
+static void restTrace(uint64_t us, int16_t xyz[3]) {
+    xyz[0] = restX;
+    xyz[1] = -200;
+    xyz[2] = 4090;
+}
+
+// The accelerometer x and timestamp of each StreamData message that
+// has one, and which were keyframes
+struct AccFrame {
+    int x;
+    uint32_t timestamp;
+    bool key;
+};
+
+static std::vector<AccFrame> accFrames(const std::string& stream) {
+    std::vector<AccFrame> frames;
+    const char* start = "{\"datatype\":\"StreamData\"";
+    for (size_t i = stream.find(start); i != std::string::npos; ) {
+        size_t next = stream.find(start, i + 1);
+        std::string message = stream.substr(i, next == std::string::npos ? std::string::npos : next - i);
+        size_t acc = message.find("\"accelerometerdata\":[");
+        if (acc != std::string::npos) {
+            AccFrame f;
+            f.x = atoi(message.c_str() + acc + 21);
+            f.timestamp = strtoul(message.c_str() + message.find("\"timestamp\":") + 12, 0, 10);
+            f.key = message.find("\"keyframe\":1") != std::string::npos;
+            frames.push_back(f);
+        }
+        i = next;
+    }
+    return frames;
+}
+
+// 7 Hz has no whole microsecond period: 420 samples a minute apart on
+// average 142857.143 us, each period rounded, none drifting
+static void testOddRate() {
+    simUsbSend(WEBUSB, "{'SETRTE':7}{'STRACC':1}");
+    simRun(100000);
+    simUsbTake(WEBUSB);
+    simRun(61000000);
+    simUsbSend(WEBUSB, "{'STRACC':0}");
+    simRun(500000);
+    std::vector<AccFrame> frames = accFrames(simUsbTake(WEBUSB));
+    CHECK(frames.size() >= 420);
+    if (frames.size() < 420)
+        return;
+
+    bool rounded = true;
+    for (int i=1; i<420; i++) {
+        uint32_t period = frames[i].timestamp - frames[i-1].timestamp;
+        if (period != 142857 && period != 142858)
+            rounded = false;
+    }
+    CHECK(rounded);
+    // Within the microsecond the ends were rounded to, where a Ticker
+    // at 142857 us would be 60 us short
+    double span = frames[419].timestamp - frames[0].timestamp;
+    CHECK(span > 419 * 1e6 / 7 - 1 && span < 419 * 1e6 / 7 + 1);
+    double mean = span / 419;
+    printf("7 Hz: mean period %.3f us over 420 samples\n", mean);
+}
+
+// SETDBD holds readings inside the dead band, SETKEY repeats them
+static void testDeadband() {
+    simSetAccTrace(restTrace);
+    simUsbSend(WEBUSB, "{'SETRTE':50}{'SETKEY':0}{'SETDBD':[1,20]}{'STRACC':1}");
+    simRun(5000000);
+    std::vector<AccFrame> frames = accFrames(simUsbTake(WEBUSB));
+    CHECK_EQ(frames.size(), 1u);  // The first reading only
+
+    // Within the band nothing, beyond it the new value once
+    restX = 120;
+    simRun(1000000);
+    CHECK(accFrames(simUsbTake(WEBUSB)).empty());
+    restX = 121;
+    simRun(1000000);
+    frames = accFrames(simUsbTake(WEBUSB));
+    CHECK_EQ(frames.size(), 1u);
+    CHECK(!frames.empty() && frames[0].x == 121 && !frames[0].key);
+
+    // Keyframes every 500 ms, each of the held value, the next one due
+    // on the first sample at least 500 ms after the last
+    simUsbSend(WEBUSB, "{'SETKEY':500}");
+    simRun(5000000);
+    frames = accFrames(simUsbTake(WEBUSB));
+    CHECK(frames.size() >= 9 && frames.size() <= 11);
+    bool spaced = true;
+    for (size_t i=0; i<frames.size(); i++) {
+        if (!frames[i].key || frames[i].x != 121)
+            spaced = false;
+        if (i && (frames[i].timestamp - frames[i-1].timestamp < 500000 ||
+                  frames[i].timestamp - frames[i-1].timestamp >= 500000 + 20000))
+            spaced = false;
+    }
+    CHECK(spaced);
+
+    simUsbSend(WEBUSB, "{'SETKEY':0}");
+    simRun(100000);
+    simUsbTake(WEBUSB);
+    simRun(5000000);
+    CHECK(accFrames(simUsbTake(WEBUSB)).empty());
+
+    simUsbSend(WEBUSB, "{'STRACC':0}{'SETDBD':[1,0]}{'SETKEY':1000}");
+    simRun(100000);
+    simUsbTake(WEBUSB);
+    simSetAccTrace(0);
+    restX = 100;
+}
+
+// Swipe, count down, record two seconds, download. The Ack of GETLOG
+// comes after the whole log.
+static void testLog() {
+    simUsbSend(WEBUSB, "{'SETRTE':50}{'LOGACC':1,'id':10}");
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":10,\"status\":\"ok\"}", 100000));
+    simSetTouch(30);
+    simRun(300000);
+    simSetTouch(0);
+    simRun(7000000);  // Countdown and some recording
+    simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'STOPLOG':1}");
+    simRun(100000);
+    simUsbSend(WEBUSB, "{'GETLOG':1,'id':11}");
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":11,\"status\":\"ok\"}", 2000000));
+    std::string log = simUsbTake(WEBUSB);
+    size_t header = log.find("\"datatype\":\"AccelerometerLog\"");
+    size_t end = log.find("]}");
+    size_t ack = log.find("{\"datatype\":\"Ack\",\"id\":11,\"status\":\"ok\"}");
+    CHECK(header != std::string::npos);
+    CHECK(end != std::string::npos && ack != std::string::npos && end < ack);
+    CHECK(countOf(log, "\n[") >= 50);
+}
+
+// Samples of a GETLOG text dump, after its header
+static std::vector<int16_t> textSamples(const std::string& log) {
+    std::vector<int16_t> samples;
+    size_t data = log.find("\"data\":[");
+    for (size_t i = log.find("\n[", data); i != std::string::npos; i = log.find("\n[", i + 1)) {
+        int x, y, z;
+        if (sscanf(log.c_str() + i + 2, "%d,%d,%d", &x, &y, &z) != 3)
+            break;
+        samples.push_back(x);
+        samples.push_back(y);
+        samples.push_back(z);
+    }
+    return samples;
+}
+
+// Parse a GETBIN reply: header, then each chunk's payload and trailer.
+// Appends the samples, false on any framing, index or CRC error.
+static bool binarySamples(const std::string& reply, uint32_t offset, uint32_t length,
+                          std::vector<int16_t>* samples, int* chunks) {
+    size_t header = reply.find("\"datatype\":\"AccelerometerLogBinary\"");
+    size_t pos = reply.find("}\n", header);
+    if (header == std::string::npos || pos == std::string::npos)
+        return false;
+    if (statusValue(reply, "\"offset\":") != (int)offset || statusValue(reply, "\"length\":") != (int)length)
+        return false;
+    uint32_t total = statusValue(reply, "\"samples\":");
+    const uint8_t* p = (const uint8_t*)reply.data() + pos + 2;
+    const uint8_t* end = (const uint8_t*)reply.data() + reply.size();
+    uint32_t next = offset;
+    *chunks = 0;
+    for (;;) {
+        uint32_t count = length - (next - offset);
+        if (count > LOG_CHUNK_SAMPLES)
+            count = LOG_CHUNK_SAMPLES;
+        if (end - p < (long)(count * 6 + LOG_CHUNK_TRAILER_SIZE))
+            return false;
+        const uint8_t* t = p + count * 6;
+        uint32_t first = get32(t + 4);
+        uint32_t crc = get32(t + 8);
+        uint32_t logTotal = get32(t + 12);
+        if (t[0] != LOG_CHUNK_SYNC || get16(t + 2) != count || first != next ||
+            crc != crc32(0, p, count * 6) || logTotal != total)
+            return false;
+        for (uint32_t i=0; i<count*3; i++)
+            samples->push_back((int16_t)(p[2*i] | (p[2*i+1] << 8)));
+        next += count;
+        p = t + LOG_CHUNK_TRAILER_SIZE;
+        (*chunks)++;
+        if (t[1] & LOG_CHUNK_LAST)
+            return next == offset + length;
+    }
+}
+
+// The log from testLog as binary chunks: the same samples as the text
+// dump, intact, resumable from any offset, and in fewer packets
+static void testBinaryLog() {
+    simUsbTake(WEBUSB);
+    uint32_t packets = simUsbPackets(WEBUSB);
+    uint64_t start = simTime();
+    simUsbSend(WEBUSB, "{'GETLOG':1,'id':12}");
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":12,\"status\":\"ok\"}", 2000000));
+    uint32_t textPackets = simUsbPackets(WEBUSB) - packets;
+    uint64_t textUs = simTime() - start;
+    std::vector<int16_t> text = textSamples(simUsbTake(WEBUSB));
+    uint32_t total = text.size() / 3;
+    CHECK(total >= 50);
+
+    packets = simUsbPackets(WEBUSB);
+    start = simTime();
+    simUsbSend(WEBUSB, "{'GETBIN':1,'id':13}");
+    CHECK(simRunUntilReceived(WEBUSB, "{\"datatype\":\"Ack\",\"id\":13,\"status\":\"ok\"}", 2000000));
+    uint32_t binPackets = simUsbPackets(WEBUSB) - packets;
+    uint64_t binUs = simTime() - start;
+    std::vector<int16_t> bin;
+    int chunks;
+    CHECK(binarySamples(simUsbTake(WEBUSB), 0, total, &bin, &chunks));
+    CHECK_EQ(chunks, (total + LOG_CHUNK_SAMPLES - 1) / LOG_CHUNK_SAMPLES);
+    CHECK(bin == text);
+    CHECK(binPackets < textPackets);
+    // Times to the SIM_RECEIVE_STEP_US steps of simRunUntilReceived
+    printf("log download, %u samples: GETLOG %u packets %u us, GETBIN %u packets %u us\n",
+           total, textPackets, (uint32_t)textUs, binPackets, (uint32_t)binUs);
+
+    // Re-request a range across a chunk boundary, and one past the end
+    uint32_t offset = total / 2 - 5;
+    char request[64];
+    snprintf(request, sizeof(request), "{'GETBIN':[%u,%u],'id':14}", offset, LOG_CHUNK_SAMPLES + 10);
+    simUsbSend(WEBUSB, request);
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":14,\"status\":\"ok\"}", 1000000));
+    std::vector<int16_t> range;
+    uint32_t length = total - offset < LOG_CHUNK_SAMPLES + 10 ? total - offset : LOG_CHUNK_SAMPLES + 10;
+    CHECK(binarySamples(simUsbTake(WEBUSB), offset, length, &range, &chunks));
+    CHECK(range.size() == 3 * length && std::equal(range.begin(), range.end(), text.begin() + 3 * offset));
+
+    // Every chunk ends a transfer, also when its 8 samples and trailer
+    // fill a packet exactly and only a zero-length packet can end it
+    uint32_t transfers[2];
+    for (int i=0; i<2; i++) {
+        uint32_t before = simUsbTransfers(WEBUSB);
+        snprintf(request, sizeof(request), "{'GETBIN':[0,%d],'id':%d}", 7 + i, 16 + i);
+        simUsbSend(WEBUSB, request);
+        snprintf(request, sizeof(request), "\"id\":%d,\"status\":\"ok\"}", 16 + i);
+        CHECK(simRunUntilReceived(WEBUSB, request, 1000000));
+        transfers[i] = simUsbTransfers(WEBUSB) - before;
+        range.clear();
+        CHECK(binarySamples(simUsbTake(WEBUSB), 0, 7 + i, &range, &chunks));
+    }
+    CHECK_EQ(transfers[1], transfers[0]);
+
+    simUsbSend(WEBUSB, "{'GETBIN':[100000,10],'id':15}");
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":15,\"status\":\"ok\"}", 1000000));
+    range.clear();
+    CHECK(binarySamples(simUsbTake(WEBUSB), total, 0, &range, &chunks));
+    CHECK_EQ(chunks, 1);
+}
+
+// A transient trigger: armed by LOGACC, started by the MMA8451Q's
+// interrupt, its settings in the log header and SETTRG locked meanwhile
+static void testMotionTrigger() {
+    simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'NOTIFY':1}{'SETRTE':50}{'SETTRG':[1,500,2]}{'LOGACC':1,'id':40}");
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":40,\"status\":\"ok\"}", 100000));
+    simRun(500000);
+    simUsbSend(WEBUSB, "{'SETTRG':[2,300,1],'id':41}");
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":41,\"status\":\"busy\"}", 100000));
+    CHECK(simUsbTake(WEBUSB).find("LoggingStarted") == std::string::npos);
+
+    simAccEvent(0x20);  // INT_SOURCE SRC_TRANS
+    CHECK(simRunUntilReceived(WEBUSB, "LoggingStarted", 100000));
+    simRun(2000000);
+    simUsbSend(WEBUSB, "{'STOPLOG':1}");
+    simRun(100000);
+    simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'GETLOG':1,'id':42}");
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":42,\"status\":\"ok\"}", 2000000));
+    std::string log = simUsbTake(WEBUSB);
+    CHECK(log.find("\"trigger\":\"transient\"") != std::string::npos);
+    CHECK_EQ(statusValue(log, "\"threshold\":"), 504);  // 8 steps of 63 mg
+    CHECK_EQ(statusValue(log, "\"count\":"), 2);
+    int samples = textSamples(log).size() / 3;
+    CHECK(samples >= 95 && samples <= 110);  // About 2 s at 50 Hz
+
+    simUsbSend(WEBUSB, "{'SETTRG':0}{'NOTIFY':0}");
+    simRun(100000);
+}
+
+// x counts sampling periods at 50 Hz, so consecutive samples differ by
+// one, wrapping within the 14-bit range
+static void countingTrace(uint64_t us, int16_t xyz[3]) {
+    xyz[0] = (int16_t)((us / 20000) % 16384) - 8192;
+    xyz[1] = -200;
+    xyz[2] = 4090;
+}
+
+// Parse a TAILOG stream: its header, then chunks of any size up to
+// LOG_CHUNK_SAMPLES, each found by the trailer that checks out right
+// after its payload. Appends the samples from offset on, false on any
+// gap or CRC error or if the LOG_CHUNK_LAST chunk is missing.
+static bool tailSamples(const std::string& stream, uint32_t offset, std::vector<int16_t>* samples,
+                        uint32_t* total) {
+    size_t header = stream.find("\"datatype\":\"AccelerometerLogTail\"");
+    size_t pos = stream.find("}\n", header);
+    if (header == std::string::npos || pos == std::string::npos ||
+        statusValue(stream, "\"offset\":") != (int)offset)
+        return false;
+    const uint8_t* p = (const uint8_t*)stream.data() + pos + 2;
+    const uint8_t* end = (const uint8_t*)stream.data() + stream.size();
+    uint32_t next = offset;
+    while (p < end) {
+        const uint8_t* t = 0;
+        uint32_t count;
+        for (count=0; count<=LOG_CHUNK_SAMPLES; count++) {
+            const uint8_t* c = p + count * 6;
+            if (end - c < LOG_CHUNK_TRAILER_SIZE)
+                return false;
+            if (c[0] == LOG_CHUNK_SYNC && (c[2] | (c[3] << 8)) == (int)count &&
+                get32(c + 4) == next && get32(c + 8) == crc32(0, p, count * 6)) {
+                t = c;
+                break;
+            }
+        }
+        if (!t)
+            return false;
+        for (uint32_t i=0; i<count*3; i++)
+            samples->push_back((int16_t)(p[2*i] | (p[2*i+1] << 8)));
+        next += count;
+        *total = get32(t + 12);
+        p = t + LOG_CHUNK_TRAILER_SIZE;
+        if (t[1] & LOG_CHUNK_LAST)
+            return next == *total;
+    }
+    return false;
+}
+
+// TAILOG sent while LOGACC waits for its swipe follows the new log, not
+// the one before it, through the countdown and the recording, and ends
+// with what GETBIN then returns. Afterwards it resumes from any index.
+static void testTailLog() {
+    simSetAccTrace(countingTrace);
+    simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'SETRTE':50}{'LOGACC':1}{'TAILOG':0}");
+    simRun(1000000);
+    std::string waiting = simUsbTake(WEBUSB);
+    CHECK(waiting.find("\"datatype\":\"AccelerometerLogTail\"") != std::string::npos);
+    CHECK_EQ(statusValue(waiting, "\"samplingrate\":"), 50);
+    simSetTouch(30);
+    simRun(300000);
+    simSetTouch(0);
+    simRun(8000000);  // Countdown and about 3 s of recording
+    simUsbSend(WEBUSB, "{'STOPLOG':1}");
+    simRun(1000000);
+    std::string stream = waiting + simUsbTake(WEBUSB);
+    std::vector<int16_t> tail;
+    uint32_t total = 0;
+    CHECK(tailSamples(stream, 0, &tail, &total));
+    CHECK(total >= 100 && total < 300);
+
+    simUsbSend(WEBUSB, "{'GETBIN':1,'id':43}");
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":43,\"status\":\"ok\"}", 2000000));
+    std::vector<int16_t> bin;
+    int chunks;
+    CHECK(binarySamples(simUsbTake(WEBUSB), 0, total, &bin, &chunks));
+    CHECK(tail == bin);
+
+    simUsbSend(WEBUSB, "{'TAILOG':10}");
+    simRun(1000000);
+    std::vector<int16_t> resumed;
+    uint32_t resumedTotal = 0;
+    CHECK(tailSamples(simUsbTake(WEBUSB), 10, &resumed, &resumedTotal));
+    CHECK_EQ(resumedTotal, total);
+    CHECK(resumed.size() == bin.size() - 30 && std::equal(resumed.begin(), resumed.end(), bin.begin() + 30));
+    simSetAccTrace(0);
+}
+
+// A compressed log runs until the arena is full, holds more samples
+// than an uncompressed one, and downloads exactly what was recorded
+static void testCompressedLog() {
+    simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'GETINF':1}");
+    CHECK(simRunUntilReceived(WEBUSB, "]}", 100000));
+    int capacity = statusValue(simUsbTake(WEBUSB), "\"logcapacity\":");
+
+    simSetAccTrace(countingTrace);
+    simUsbSend(WEBUSB, "{'NOTIFY':1}{'SETRTE':50}{'SETCMP':1}{'LOGACC':1}");
+    simRun(100000);
+    simSetTouch(30);
+    simRun(300000);
+    simSetTouch(0);
+    // Seconds at a time, the log takes minutes to fill
+    for (int i=0; i<3600 && !simRunUntilReceived(WEBUSB, "LoggingEnded", 0); i++)
+        simRun(1000000);
+    CHECK(simRunUntilReceived(WEBUSB, "LoggingEnded", 0));
+    simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'GETLOG':1,'id':30}");
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":30,\"status\":\"ok\"}", 60000000));
+    std::string log = simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'SETCMP':0}{'NOTIFY':0}");
+    simRun(100000);
+    simSetAccTrace(0);
+
+    int samples = 0;
+    bool consecutive = true;
+    int last = 0;
+    for (size_t i = log.find("\n["); i != std::string::npos; i = log.find("\n[", i + 1)) {
+        int x, y, z;
+        if (sscanf(log.c_str() + i + 2, "%d,%d,%d", &x, &y, &z) != 3 || y != -200 || z != 4090)
+            consecutive = false;
+        if (samples && ((x - last) & 0x3FFF) != 1)
+            consecutive = false;
+        last = x;
+        samples++;
+    }
+    CHECK(samples > 2 * capacity);
+    CHECK(consecutive);
+}
+
+// True if every sample of a countingTrace log follows the one before
+static bool counting(const std::vector<int16_t>& samples) {
+    for (size_t i=3; i<samples.size(); i+=3) {
+        if (((samples[i] - samples[i-3]) & 0x3FFF) != 1 || samples[i+1] != -200 || samples[i+2] != 4090)
+            return false;
+    }
+    return true;
+}
+
+// Records a pre-trigger log: armed for preUs, then triggered by motion.
+// Returns the GETLOG reply.
+static std::string pretriggerLog(int pretrigger, uint64_t preUs) {
+    char setpre[32];
+    snprintf(setpre, sizeof(setpre), "{'SETPRE':%d}", pretrigger);
+    simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, std::string("{'NOTIFY':1}{'SETRTE':50}{'SETTRG':[1,500,1]}") + setpre + "{'LOGACC':1,'id':50}");
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":50,\"status\":\"ok\"}", 100000));
+    for (uint64_t us=0; us<preUs; us+=1000000)
+        simRun(preUs - us < 1000000 ? preUs - us : 1000000);
+    simAccEvent(0x20);  // INT_SOURCE SRC_TRANS
+    CHECK(simRunUntilReceived(WEBUSB, "LoggingStarted", 100000));
+    for (int i=0; i<300 && !simRunUntilReceived(WEBUSB, "LoggingEnded", 0); i++)
+        simRun(1000000);
+    CHECK(simRunUntilReceived(WEBUSB, "LoggingEnded", 0));
+    simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'GETLOG':1,'id':51}");
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":51,\"status\":\"ok\"}", 60000000));
+    std::string log = simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'SETPRE':0}{'SETTRG':0}{'NOTIFY':0}");
+    simRun(100000);
+    return log;
+}
+
+// SETPRE: the ring wraps while armed and still comes out oldest first,
+// a trigger before the ring holds the pre-trigger samples reports the
+// ones it has, and the ring must leave room for a post-trigger sample
+static void testPretrigger() {
+    simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'GETINF':1}");
+    CHECK(simRunUntilReceived(WEBUSB, "]}", 100000));
+    int capacity = statusValue(simUsbTake(WEBUSB), "\"logcapacity\":");
+    simSetAccTrace(countingTrace);
+
+    // Armed for two ring lengths at 50 Hz
+    std::string log = pretriggerLog(100, 2 * capacity * 20000ULL);
+    std::vector<int16_t> samples = textSamples(log);
+    CHECK_EQ(statusValue(log, "\"pretrigger\":"), 100);
+    CHECK_EQ((int)samples.size() / 3, capacity);
+    CHECK(counting(samples));
+
+    // A second of pre-trigger samples
+    log = pretriggerLog(100, 1000000);
+    samples = textSamples(log);
+    CHECK_EQ(statusValue(log, "\"pretrigger\":"), 50);
+    CHECK_EQ((int)samples.size() / 3, 50 + capacity - 100);
+    CHECK(counting(samples));
+    simSetAccTrace(0);
+
+    char request[48];
+    snprintf(request, sizeof(request), "{'SETPRE':%d,'id':52}", capacity);
+    simUsbSend(WEBUSB, request);
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":52,\"status\":\"invalid\"}", 100000));
+    snprintf(request, sizeof(request), "{'SETPRE':%d,'id':53}", capacity - 1);
+    simUsbSend(WEBUSB, request);
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":53,\"status\":\"ok\"}", 100000));
+    simUsbSend(WEBUSB, "{'SETPRE':0}");
+    simRun(100000);
+}
+
+// Both interfaces at once, each gets its own replies
+static void testSessions() {
+    simUsbSetDtr(CDC, true);
+    simRun(10000);
+    simUsbTake(WEBUSB);
+    simUsbTake(CDC);
+    simUsbSend(CDC, "{'GETINF':1,'id':20}");
+    simUsbSend(WEBUSB, "{'SETRTE':30,'id':21}");
+    CHECK(simRunUntilReceived(CDC, "\"id\":20,\"status\":\"ok\"}", 100000));
+    CHECK(simRunUntilReceived(WEBUSB, "\"id\":21,\"status\":\"ok\"}", 100000));
+    std::string cdc = simUsbTake(CDC);
+    std::string web = simUsbTake(WEBUSB);
+    CHECK(cdc.find("HardwareInfo") != std::string::npos);
+    CHECK(web.find("HardwareInfo") == std::string::npos);
+    CHECK(cdc.find("\"id\":21") == std::string::npos);
+}
+
+// A recorded trace comes out of the stream sample for sample
+static void testTrace(const char* path) {
+    CHECK(simLoadAccTrace(path));
+    simUsbSend(WEBUSB, "{'SETRTE':100}{'STRACC':1}");
+    simRun(4000000);
+    simUsbSend(WEBUSB, "{'STRACC':0}");
+    simRun(100000);
+    simSetAccTrace(0);
+    std::string stream = simUsbTake(WEBUSB);
+    CHECK(stream.find("[0,0,4096]") != std::string::npos);
+    CHECK(stream.find("[4096,0,0]") != std::string::npos);
+    CHECK(stream.find("[0,0,0]") != std::string::npos);
+    CHECK(stream.find("[-2500,3100,8191]") != std::string::npos);
+}
+
+// Two readers of the sample ring: the WebUSB host stops reading for two
+// seconds and drops its oldest samples, the terminal misses nothing
+static void testStalledHost() {
+    simUsbSend(WEBUSB, "{'SETRTE':100}{'SETDRP':1}{'STRACC':1}");
+    simUsbSend(CDC, "{'SETRTE':100}{'STRACC':1}{'RSTSTS':1}");
+    simRun(100000);
+    simUsbTake(WEBUSB);
+    simUsbTake(CDC);
+    simUsbSetReading(WEBUSB, false);
+    simRun(1000000);
+    // A reply to the stalled host waits for it once, for USB_TX_STALL_US
+    simUsbSend(WEBUSB, "{'GETINF':1}{'GETINF':1}");
+    simRun(1000000);
+    simUsbSetReading(WEBUSB, true);
+    simRun(1000000);
+    simUsbSend(WEBUSB, "{'STRACC':0}{'SETDRP':0}");
+    simUsbSend(CDC, "{'STRACC':0}");
+    simRun(100000);
+
+    int webFrames, cdcFrames;
+    CHECK_EQ(seqGaps(simUsbTake(CDC), &cdcFrames), 0);
+    CHECK(cdcFrames >= 295);
+    CHECK(seqGaps(simUsbTake(WEBUSB), &webFrames) > 0);
+    CHECK(webFrames >= 100 && webFrames < cdcFrames);
+    simUsbSend(CDC, "{'GETSTS':1}");
+    CHECK(simRunUntilReceived(CDC, "]}}", 100000));
+    std::string status = simUsbTake(CDC);
+    CHECK(statusValue(status, "\"dropped\":") > 0);
+    CHECK_EQ(statusValue(status, "\"overruns\":"), 0);
+    size_t command = status.find("\"command\":");
+    CHECK(command != std::string::npos);
+    int commandMax = statusValue(status.substr(command), "\"max\":");
+    CHECK(commandMax >= USB_TX_STALL_US && commandMax < 2 * USB_TX_STALL_US);
+}
+
+// An hour at 100 Hz, which takes about a second: nothing lost
+static void testSoak() {
+    simUsbSend(WEBUSB, "{'SETRTE':100}{'STRTCH':1}{'STRACC':1}{'RSTSTS':1}");
+    int frames = 0;
+    for (int i=0; i<3600; i++) {
+        simRun(1000000);
+        frames += countOf(simUsbTake(WEBUSB), "\"datatype\":\"StreamData\"");
+    }
+    simUsbSend(WEBUSB, "{'STRACC':0}{'STRTCH':0}");
+    simRun(100000);
+    simUsbTake(WEBUSB);
+    simUsbSend(WEBUSB, "{'GETSTS':1}");
+    CHECK(simRunUntilReceived(WEBUSB, "]}}", 100000));
+    std::string status = simUsbTake(WEBUSB);
+    CHECK(frames >= 359990);
+    CHECK(statusValue(status, "\"samples\":") >= 359990);
+    CHECK_EQ(statusValue(status, "\"overruns\":"), 0);
+    CHECK_EQ(statusValue(status, "\"dropped\":"), 0);
+    CHECK_EQ(statusValue(status, "\"usbdropped\":"), 0);
+}
+
+int main(int argc, char** argv) {
+    simBoot(firmwareMain);
+    simUsbConfigure();
+    simUsbSetDtr(WEBUSB, true);
+    simRun(10000);
+
+    testInfo();
+    testAcks();
+    testCommandTable();
+    testStream();
+    testBinaryStream();
+    testFifoStream();
+    testSensorRates();
+    testDeadband();
+    testOddRate();
+    testLog();
+    testBinaryLog();
+    testMotionTrigger();
+    testTailLog();
+    testCompressedLog();
+    testPretrigger();
+    testSessions();
+    testStalledHost();
+    if (argc > 1)
+        testTrace(argv[1]);
+    testSoak();
+    return checkResult("firmware");
+}
@@ -0,0 +1,126 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+// IntText: byte-identical to sprintf for every width and pad used, over
+// the edges and random values, and how it compares in speed on the host
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "IntText.h"
+#include "Check.h"
+
+static const int32_t edges[] = {
+    0, 1, -1, 9, 10, -10, 99, 100, 999, 1000, 8191, -8192, 32767, -32768,
+    65535, 999999999, 1000000000, -1000000000, 2147483647, -2147483647 - 1,
+};
+
+static bool sameUint(uint32_t v) {
+    char buf[11], expected[16];
+    buf[uintToText(v, buf)] = 0;
+    sprintf(expected, "%u", (unsigned int)v);
+    return !strcmp(buf, expected);
+}
+
+template<int Width, char Pad>
+static bool sameInt(int32_t v) {
+    char buf[16], expected[16];
+    buf[intToText<Width,Pad>(v, buf)] = 0;
+    if (Pad == '0')
+        sprintf(expected, "%0*d", Width, (int)v);
+    else
+        sprintf(expected, "%*d", Width, (int)v);
+    return !strcmp(buf, expected);
+}
+
+template<int Width, char Pad>
+static int intMismatches() {
+    int bad = 0;
+    for (unsigned int i=0; i<sizeof(edges)/sizeof(edges[0]); i++)
+        bad += !sameInt<Width,Pad>(edges[i]);
+    for (int i=0; i<100000; i++) {
+        int32_t v = ((uint32_t)rand() << 16) ^ rand();
+        bad += !sameInt<Width,Pad>(v);
+        bad += !sameInt<Width,Pad>(v >> (rand() % 32));  // All lengths
+    }
+    return bad;
+}
+
+static void testText() {
+    int bad = 0;
+    for (unsigned int i=0; i<sizeof(edges)/sizeof(edges[0]); i++)
+        bad += !sameUint(edges[i]);
+    bad += !sameUint(4294967295u);
+    for (int i=0; i<100000; i++)
+        bad += !sameUint(((uint32_t)rand() << 16) ^ rand());
+    CHECK_EQ(bad, 0);
+
+    CHECK_EQ((intMismatches<0,' '>()), 0);
+    CHECK_EQ((intMismatches<4,' '>()), 0);
+    CHECK_EQ((intMismatches<4,'0'>()), 0);
+    CHECK_EQ((intMismatches<6,' '>()), 0);
+    CHECK_EQ((intMismatches<11,'0'>()), 0);
+}
+
+// Host time per sample line as the streams print it, three 14-bit
+// values. The host divides in hardware and its sprintf is tuned for it,
+// so only the GETBEN cycle counts show the gain on the Cortex-M0+.
+#define BENCH_SAMPLES 1000000
+
+static void benchmark() {
+    static int16_t xyz[3 * 1024];
+    char buf[64];
+    unsigned long sum = 0;
+    for (int i=0; i<3*1024; i++)
+        xyz[i] = rand() % 16384 - 8192;
+
+    clock_t start = clock();
+    for (int i=0; i<BENCH_SAMPLES; i++) {
+        const int16_t* s = &xyz[3 * (i & 1023)];
+        sum += sprintf(buf, "[%d,%d,%d],\n", s[0], s[1], s[2]);
+    }
+    double printfTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    for (int i=0; i<BENCH_SAMPLES; i++) {
+        const int16_t* s = &xyz[3 * (i & 1023)];
+        char* p = buf;
+        *p++ = '[';
+        p += intToText<0,' '>(s[0], p);
+        *p++ = ',';
+        p += intToText<0,' '>(s[1], p);
+        *p++ = ',';
+        p += intToText<0,' '>(s[2], p);
+        *p++ = ']';
+        *p++ = ',';
+        *p++ = '\n';
+        sum -= p - buf;
+    }
+    double textTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    CHECK_EQ(sum, 0);  // Same lengths
+    printf("int_text: sprintf %.0f ns/sample, intToText %.0f ns/sample\n",
+           printfTime * 1e9 / BENCH_SAMPLES, textTime * 1e9 / BENCH_SAMPLES);
+}
+
+int main() {
+    srand(1);
+    testText();
+    benchmark();
+    return checkResult("int_text");
+}
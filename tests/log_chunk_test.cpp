@@ -0,0 +1,83 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+// LogChunk: the nibble-table CRC-32 against a bit-by-bit reference, and
+// the trailer layout a host parses
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "LogChunk.h"
+#include "Check.h"
+
+// Reflected IEEE 802.3 CRC-32, one bit at a time
+static uint32_t referenceCrc32(const uint8_t* buf, uint32_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i=0; i<len; i++) {
+        crc ^= buf[i];
+        for (int bit=0; bit<8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static void testCrc() {
+    CHECK_EQ(crc32(0, (const uint8_t*)"123456789", 9), 0xCBF43926);  // The check value
+    CHECK_EQ(crc32(0, 0, 0), 0);
+
+    uint8_t buf[1024];
+    for (int n=0; n<200; n++) {
+        uint32_t len = rand() % sizeof(buf);
+        for (uint32_t i=0; i<len; i++)
+            buf[i] = rand();
+        uint32_t crc = crc32(0, buf, len);
+        CHECK_EQ(crc, referenceCrc32(buf, len));
+
+        // Piecewise, as a chunk that wraps around the end of the log
+        uint32_t split = len ? rand() % len : 0;
+        CHECK_EQ(crc32(crc32(0, buf, split), buf + split, len - split), crc);
+
+        // Any single bit error shows
+        if (len) {
+            buf[rand() % len] ^= 1 << (rand() % 8);
+            CHECK(crc32(0, buf, len) != crc);
+        }
+    }
+}
+
+static void testTrailer() {
+    uint8_t buf[LOG_CHUNK_TRAILER_SIZE + 1];
+    buf[LOG_CHUNK_TRAILER_SIZE] = 0xAA;
+    encodeLogChunkTrailer(buf, LOG_CHUNK_LAST, 0x1234, 0x89ABCDEF, 0xCBF43926, 0x01020304);
+    static const uint8_t expected[LOG_CHUNK_TRAILER_SIZE] = {
+        LOG_CHUNK_SYNC, LOG_CHUNK_LAST, 0x34, 0x12,
+        0xEF, 0xCD, 0xAB, 0x89,
+        0x26, 0x39, 0xF4, 0xCB,
+        0x04, 0x03, 0x02, 0x01,
+    };
+    CHECK(!memcmp(buf, expected, sizeof(expected)));
+    CHECK_EQ(buf[LOG_CHUNK_TRAILER_SIZE], 0xAA);
+
+    // Full chunks end on a bulk packet boundary
+    CHECK_EQ(LOG_CHUNK_SAMPLES * 6 % 64, 0);
+}
+
+int main() {
+    srand(1);
+    testCrc();
+    testTrailer();
+    return checkResult("log_chunk");
+}
@@ -0,0 +1,136 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+// MMA8451QFifo against the simulated accelerometer on the I2C bus
+
+#include "MMA8451QFifo.h"
+#include "Sim.h"
+#include "Check.h"
+
+#define ADDRESS (0x1d<<1)
+
+// Each sample carries its own time, in data rate periods of 400 Hz
+static void countingTrace(uint64_t us, int16_t xyz[3]) {
+    xyz[0] = (int16_t)(us / 2500);
+    xyz[1] = -(int16_t)(us / 2500);
+    xyz[2] = 4096;
+}
+
+// A global like the firmware's accInt, constructed before main()
+static InterruptIn globalInt(PTA14);
+static int globalIntFalls = 0;
+
+static void globalIntFall() {
+    globalIntFalls++;
+}
+
+static uint8_t readReg(int reg) {
+    char r = reg, v = 0;
+    I2C i2c(PTE25, PTE24);
+    i2c.write(ADDRESS, &r, 1, true);
+    i2c.read(ADDRESS, &v, 1);
+    return v;
+}
+
+static void testEnable() {
+    MMA8451QFifo fifo(PTE25, PTE24, ADDRESS);
+
+    CHECK(MMA8451QFifo::isValidRate(800));
+    CHECK(MMA8451QFifo::isValidRate(50));
+    CHECK(!MMA8451QFifo::isValidRate(300));
+    CHECK(!fifo.enable(300, 16));
+    CHECK(!fifo.enable(400, 0));
+    CHECK(!fifo.enable(400, MMA8451Q_FIFO_DEPTH + 1));
+
+    CHECK(fifo.enable(400, 16));
+    CHECK_EQ(readReg(0x09), 0x80 | 16);      // F_SETUP fill mode, watermark
+    CHECK_EQ(readReg(0x2A), (1 << 3) | 1);   // CTRL_REG1 400 Hz, active
+    fifo.disable();
+    CHECK_EQ(readReg(0x09), 0);
+    CHECK_EQ(readReg(0x2A), 1);
+}
+
+// Burst reads return every sample once, in order, at the data rate
+static void testDrain() {
+    MMA8451QFifo fifo(PTE25, PTE24, ADDRESS);
+    int16_t xyz[MMA8451Q_FIFO_DEPTH * 3];
+    bool overflowed;
+
+    simSetAccTrace(countingTrace);
+    CHECK(fifo.enable(400, 16));
+    fifo.flush();
+    int16_t next = -1;
+    int total = 0;
+    bool inOrder = true;
+    for (int i=0; i<200; i++) {
+        simRun(40000);  // 16 samples
+        int n = fifo.readFifo(xyz, MMA8451Q_FIFO_DEPTH, &overflowed);
+        CHECK(!overflowed);
+        for (int j=0; j<n; j++) {
+            if (next >= 0 && xyz[3*j] != next)
+                inOrder = false;
+            if (xyz[3*j + 1] != -xyz[3*j] || xyz[3*j + 2] != 4096)
+                inOrder = false;
+            next = xyz[3*j] + 1;
+        }
+        total += n;
+    }
+    CHECK(inOrder);
+    CHECK(total >= 200*16 - 1 && total <= 200*16 + 1);
+
+    // Fewer than asked for are left for the next read
+    simRun(40000);
+    CHECK_EQ(fifo.readFifo(xyz, 10, &overflowed), 10);
+    CHECK_EQ(xyz[0], next);
+    CHECK_EQ(fifo.readFifo(xyz, MMA8451Q_FIFO_DEPTH, &overflowed), 6);
+    CHECK_EQ(xyz[0], next + 10);
+    fifo.disable();
+}
+
+// Reads too far apart: the FIFO stops at 32 and says so
+static void testOverflow() {
+    MMA8451QFifo fifo(PTE25, PTE24, ADDRESS);
+    int16_t xyz[MMA8451Q_FIFO_DEPTH * 3];
+    bool overflowed;
+
+    CHECK(fifo.enable(800, 16));
+    fifo.flush();
+    simRun(100000);
+    CHECK_EQ(fifo.readFifo(xyz, MMA8451Q_FIFO_DEPTH, &overflowed), MMA8451Q_FIFO_DEPTH);
+    CHECK(overflowed);
+    simRun(10000);
+    fifo.readFifo(xyz, MMA8451Q_FIFO_DEPTH, &overflowed);
+    CHECK(!overflowed);
+    fifo.disable();
+}
+
+// An accelerometer event reaches interrupt pins made before main() too
+static void testInterrupt() {
+    globalInt.fall(globalIntFall);
+    simAccEvent(0x20);
+    simRun(10);
+    CHECK_EQ(globalIntFalls, 1);
+    CHECK_EQ(readReg(0x0C) & 0x20, 0x20);  // INT_SOURCE latched
+}
+
+int main() {
+    testInterrupt();
+    testEnable();
+    testDrain();
+    testOverflow();
+    return checkResult("mma8451q_fifo");
+}
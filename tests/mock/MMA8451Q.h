@@ -0,0 +1,44 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef MMA8451Q_H
+#define MMA8451Q_H
+
+#include "mbed.h"
+
+// Host stand-in for the MMA8451Q library, reading the simulated
+// accelerometer over the simulated I2C bus like the real one
+class MMA8451Q {
+public:
+    MMA8451Q(PinName sda, PinName scl, int addr=(0x1d<<1));
+
+    uint8_t getWhoAmI();
+    float getAccX();
+    float getAccY();
+    float getAccZ();
+    void getAccAllAxis(int16_t* res);
+
+private:
+    int16_t getAccAxis(uint8_t addr);
+    void readRegs(int addr, uint8_t* data, int len);
+    void writeRegs(uint8_t* data, int len);
+
+    I2C m_i2c;
+    int m_addr;
+};
+
+#endif
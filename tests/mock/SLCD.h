@@ -0,0 +1,39 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef SLCD_H
+#define SLCD_H
+
+#include "mbed.h"
+
+// Host stand-in for the KL46Z segment LCD, keeps the last text printed
+class SLCD {
+public:
+    SLCD() {}
+    void printf(const char* format, ...);
+    void DP1(int on) { m_dp[0] = on; }
+    void DP2(int on) { m_dp[1] = on; }
+    void DP3(int on) { m_dp[2] = on; }
+    void Colon(int on) { m_colon = on; }
+    void clear() { printf("    "); }
+
+private:
+    int m_dp[3];
+    int m_colon;
+};
+
+#endif
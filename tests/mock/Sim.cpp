@@ -0,0 +1,348 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ucontext.h>
+#include <vector>
+
+#include "mbed.h"
+#include "Sim.h"
+
+#define FIRMWARE_STACK_SIZE (1024*1024)
+
+struct SimEvent {
+    uint64_t when;
+    uint64_t seq;        // Keeps events due at the same time in order
+    uint32_t period;     // Rescheduled after each call when not 0
+    void* owner;         // For simCancel()
+    void (*fn)(void* arg);
+    void* arg;
+};
+
+static std::vector<SimEvent> events;
+static uint64_t now = 0;
+static uint64_t eventSeq = 0;
+static uint64_t runUntil = 0;
+static int isrDepth = 0;
+static bool irqEnabled = true;
+
+static ucontext_t hostContext;
+static ucontext_t firmwareContext;
+static int (*firmwareEntry)(void) = 0;
+static bool inFirmware = false;
+
+uint64_t simTime() {
+    return now;
+}
+
+void simSchedule(uint64_t when, uint32_t period, void* owner, void (*fn)(void* arg), void* arg) {
+    SimEvent e;
+    e.when = when < now ? now : when;
+    e.seq = eventSeq++;
+    e.period = period;
+    e.owner = owner;
+    e.fn = fn;
+    e.arg = arg;
+    events.push_back(e);
+}
+
+void simCancel(void* owner) {
+    for (size_t i=0; i<events.size(); ) {
+        if (events[i].owner == owner)
+            events.erase(events.begin() + i);
+        else
+            i++;
+    }
+}
+
+void simAt(uint64_t when, void (*fn)(void* arg), void* arg) {
+    simSchedule(when, 0, 0, fn, arg);
+}
+
+// Earliest pending event, -1 if none
+static int nextEvent() {
+    int next = -1;
+    for (size_t i=0; i<events.size(); i++) {
+        if (next < 0 || events[i].when < events[next].when ||
+                (events[i].when == events[next].when && events[i].seq < events[next].seq))
+            next = i;
+    }
+    return next;
+}
+
+// Run the interrupt handlers that are due, unless they are masked or
+// one is running already
+static void dispatch() {
+    if (isrDepth || !irqEnabled)
+        return;
+    for (;;) {
+        int i = nextEvent();
+        if (i < 0 || events[i].when > now)
+            break;
+        SimEvent e = events[i];
+        events.erase(events.begin() + i);
+        if (e.period)
+            simSchedule(e.when + e.period, e.period, e.owner, e.fn, e.arg);
+        isrDepth++;
+        e.fn(e.arg);
+        isrDepth--;
+    }
+}
+
+// Hand control back to the test once the run time is up
+static void yieldIfDone() {
+    if (inFirmware && !isrDepth && now >= runUntil) {
+        inFirmware = false;
+        swapcontext(&firmwareContext, &hostContext);
+    }
+}
+
+static void firmwareStart() {
+    firmwareEntry();
+    fprintf(stderr, "sim: firmware main() returned\n");
+    abort();
+}
+
+void simBoot(int (*firmwareMain)(void)) {
+    static char* stack = 0;
+
+    if (!stack)
+        stack = (char*)malloc(FIRMWARE_STACK_SIZE);
+    firmwareEntry = firmwareMain;
+    getcontext(&firmwareContext);
+    firmwareContext.uc_stack.ss_sp = stack;
+    firmwareContext.uc_stack.ss_size = FIRMWARE_STACK_SIZE;
+    firmwareContext.uc_link = 0;
+    makecontext(&firmwareContext, firmwareStart, 0);
+    simRun(0);
+}
+
+void simRun(uint32_t us) {
+    runUntil = now + us;
+    if (!firmwareEntry) {
+        now = runUntil;
+        dispatch();
+        return;
+    }
+    inFirmware = true;
+    swapcontext(&hostContext, &firmwareContext);
+}
+
+void simLoopStep(uint32_t us) {
+    now += us;
+    dispatch();
+    yieldIfDone();
+}
+
+void simTickerRead() {
+    if (isrDepth || !irqEnabled || !inFirmware)
+        return;
+    now++;
+    dispatch();
+}
+
+void simIrqDisable() {
+    irqEnabled = false;
+}
+
+void simIrqEnable() {
+    irqEnabled = true;
+    dispatch();
+}
+
+// Wait for the next interrupt. It is left pending, like WFI with
+// interrupts disabled, and runs once they are enabled again.
+void simSleep() {
+    int i = nextEvent();
+    uint64_t wake = i < 0 ? runUntil : events[i].when;
+
+    if (wake > runUntil)
+        wake = runUntil;
+    if (wake > now)
+        now = wake;
+    dispatch();
+    yieldIfDone();
+}
+
+// 64-bit time of a 32-bit us_ticker timestamp, one in the past is due now
+uint64_t simDeadline(uint32_t timestamp) {
+    int32_t delta = (int32_t)(timestamp - (uint32_t)now);
+    return delta > 0 ? now + delta : now;
+}
+
+// mbed HAL
+
+extern "C" uint32_t us_ticker_read(void) {
+    simTickerRead();
+    return (uint32_t)now;
+}
+
+void sleep(void) {
+    simSleep();
+}
+
+void deepsleep(void) {
+    simSleep();
+}
+
+void wait_us(int us) {
+    simLoopStep(us);
+}
+
+extern "C" void error(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    abort();
+}
+
+void __disable_irq(void) {
+    simIrqDisable();
+}
+
+void __enable_irq(void) {
+    simIrqEnable();
+}
+
+Timer::Timer() : m_start(0), m_elapsed(0), m_running(false) {
+}
+
+void Timer::start() {
+    if (!m_running) {
+        m_start = now;
+        m_running = true;
+    }
+}
+
+void Timer::stop() {
+    if (m_running) {
+        m_elapsed += now - m_start;
+        m_running = false;
+    }
+}
+
+void Timer::reset() {
+    m_start = now;
+    m_elapsed = 0;
+}
+
+int Timer::read_us() {
+    return (int)(m_elapsed + (m_running ? now - m_start : 0));
+}
+
+int Timer::read_ms() {
+    return read_us() / 1000;
+}
+
+float Timer::read() {
+    return read_us() / 1000000.0f;
+}
+
+static void tickerIrq(void* ticker) {
+    Ticker::irq((Ticker*)ticker);
+}
+
+void Ticker::attach_us(void (*fptr)(void), uint32_t us) {
+    simCancel(this);
+    m_fptr = fptr;
+    m_period = us ? us : 1;
+    simSchedule(now + m_period, m_period, this, tickerIrq, this);
+}
+
+void Ticker::detach() {
+    simCancel(this);
+    m_fptr = 0;
+}
+
+void Ticker::irq(Ticker* ticker) {
+    if (ticker->m_fptr)
+        ticker->m_fptr();
+}
+
+static void timerEventIrq(void* event) {
+    TimerEvent::irq((TimerEvent*)event);
+}
+
+void TimerEvent::insert(timestamp_t timestamp) {
+    simCancel(this);
+    simSchedule(simDeadline(timestamp), 0, this, timerEventIrq, this);
+}
+
+void TimerEvent::remove() {
+    simCancel(this);
+}
+
+InterruptIn::InterruptIn(PinName pin) : m_pin(pin), m_rise(0), m_fall(0), m_enabled(true) {
+    simAddInterruptIn(this, pin);
+}
+
+InterruptIn::~InterruptIn() {
+    simRemoveInterruptIn(this);
+}
+
+void InterruptIn::irq(InterruptIn* in, bool rising) {
+    void (*fptr)(void) = rising ? in->m_rise : in->m_fall;
+
+    if (in->m_enabled && fptr)
+        fptr();
+}
+
+PwmOut::PwmOut(PinName pin) : m_period(0.02f), m_value(0) {
+}
+
+uint16_t AnalogIn::read_u16() {
+    return simLight();
+}
+
+int I2C::write(int address, const char* data, int length, bool repeated) {
+    return simI2CWrite(address, data, length);
+}
+
+int I2C::read(int address, char* data, int length, bool repeated) {
+    return simI2CRead(address, data, length);
+}
+
+// SysTick follows the host clock, see mbed.h
+
+static SysTick_Type sysTick;
+SysTick_Type* SysTick = &sysTick;
+uint32_t SystemCoreClock = 48000000;
+
+static uint32_t sysTickBase = 0;
+
+SIM_Type simSIM = {0x0000, 0x4E454D55, 0x4C415445};
+
+static uint32_t hostCycles() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ns = (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+    return (uint32_t)(ns * (SystemCoreClock / 1000000) / 1000);
+}
+
+SysTickVal::operator uint32_t() const {
+    return (sysTickBase - hostCycles()) & 0x00FFFFFF;
+}
+
+SysTickVal& SysTickVal::operator=(uint32_t value) {
+    sysTickBase = value + hostCycles();
+    return *this;
+}
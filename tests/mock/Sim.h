@@ -0,0 +1,104 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <string>
+
+// Host simulation of the board the firmware runs on.
+//
+// Time is simulated and only moves when the firmware waits: sleep()
+// jumps to the next timer, ticker or USB event, each main loop pass
+// through the USB read costs SIM_LOOP_US, and each us_ticker_read()
+// outside an interrupt costs a microsecond, so busy-wait loops end.
+// Interrupt handlers run at their simulated time, between the
+// firmware's own statements, unless it has disabled interrupts.
+//
+// The firmware's main() runs as a coroutine next to the test: simRun()
+// lets it go for a stretch of simulated time and returns when that is
+// up, so a test reads like a script of host actions and checks, and
+// hours of streaming take seconds.
+
+#define SIM_LOOP_US 5    // Simulated cost of one USB read poll
+#define SIM_RECEIVE_STEP_US 100  // How often simRunUntilReceived() looks
+
+// Start the firmware and run it until its main loop is up
+void simBoot(int (*firmwareMain)(void));
+// Let the firmware run for us of simulated time. Without a firmware,
+// just moves the time on and runs the interrupts due.
+void simRun(uint32_t us);
+// Simulated microseconds since the start
+uint64_t simTime();
+
+// Call fn from an interrupt at a simulated time
+void simAt(uint64_t when, void (*fn)(void* arg), void* arg);
+
+// USB host. isCDC picks the interface like the firmware does, the
+// WebUSB interface otherwise.
+void simUsbConfigure();                        // Enumerate
+void simUsbReset();                            // Bus reset, as on unplug
+void simUsbSetDtr(bool isCDC, bool on);        // Open or close the port
+void simUsbSend(bool isCDC, const std::string& data);  // Split in bulk packets
+void simUsbSetReading(bool isCDC, bool reading);  // A host that stops reading stalls the IN endpoint
+void simUsbSetPacketTime(uint32_t us);         // Time the host takes per IN packet
+std::string simUsbTake(bool isCDC);            // Everything received since the last take
+uint32_t simUsbPackets(bool isCDC);            // IN packets received in total
+uint32_t simUsbTransfers(bool isCDC);          // IN transfers, ended by a short or zero-length packet
+// Run until the text received since the last take contains needle,
+// false on timeout
+bool simRunUntilReceived(bool isCDC, const char* needle, uint32_t timeoutUs);
+
+// Sensors. Traces give the reading at a simulated time, accelerometer
+// values are 14-bit counts, 4096 per g in the 2 g range.
+typedef void (*SimTrace)(uint64_t us, int16_t xyz[3]);
+void simSetAccTrace(SimTrace trace);
+// Replay "us,x,y,z" lines from a CSV file from now on, holding each row
+// until the next
+bool simLoadAccTrace(const char* path);
+void simSetMagTrace(SimTrace trace);
+void simSetMagPresent(bool present);
+// Latch an MMA8451Q INT_SOURCE event and pull INT1 low
+void simAccEvent(uint8_t intSource);
+void simSetTouch(uint8_t distance);
+void simSetLight(uint16_t value);
+const char* simLcdText();
+
+// For the stand-ins
+class USBDevice;
+void simIrqDisable();
+void simIrqEnable();
+void simSleep();
+void simLoopStep(uint32_t us);
+void simTickerRead();
+uint64_t simDeadline(uint32_t timestamp);
+void simSchedule(uint64_t when, uint32_t period, void* owner, void (*fn)(void* arg), void* arg);
+void simCancel(void* owner);
+void simUsbAttach(USBDevice* device);
+bool simUsbConfigured();
+uint32_t simUsbEndpointWrite(uint8_t endpoint, const uint8_t* data, uint32_t size);
+bool simUsbRead(uint8_t endpoint, uint8_t* buffer, uint32_t* size, uint32_t maxSize);
+int simI2CWrite(int address, const char* data, int length);
+int simI2CRead(int address, char* data, int length);
+void simAddInterruptIn(void* in, int pin);
+void simRemoveInterruptIn(void* in);
+uint8_t simTouch();
+uint16_t simLight();
+void simSetLcdText(const char* text);
+
+#endif
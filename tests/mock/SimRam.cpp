@@ -0,0 +1,59 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+// RAM the target's GCC linker script leaves to the heap and the stack,
+// with the symbols and _sbrk() the firmware's sizeArena() uses. Built
+// per target, sized so the arena is as large as the static block other
+// toolchains use, which keeps the log capacities the same.
+
+#include <errno.h>
+#include <stdint.h>
+
+#if defined(TARGET_KL25Z)
+#define SIM_FREE_RAM (11*1024)  // 8 KB arena, 1 KB heap and 2 KB stack reserve
+#else
+#define SIM_FREE_RAM (27*1024)  // 24 KB arena
+#endif
+#define SIM_STACK_SECTION 1024  // The startup code's .stack
+
+#define SIM_STR(x) SIM_STR2(x)
+#define SIM_STR2(x) #x
+
+extern "C" {
+uint8_t simRam[SIM_FREE_RAM] __attribute__((aligned(8)));
+}
+
+// Where the linker script would put them
+__asm__(".globl __StackLimit\n"
+        ".set __StackLimit, simRam + " SIM_STR(SIM_FREE_RAM - SIM_STACK_SECTION) "\n"
+        ".globl __StackTop\n"
+        ".set __StackTop, simRam + " SIM_STR(SIM_FREE_RAM) "\n");
+
+extern "C" uint8_t __StackLimit[];
+
+// Like the mbed library's: the heap grows up from the end of the
+// statics and fails at the stack
+extern "C" void* _sbrk(int incr) {
+    static uint8_t* heap = simRam;
+    uint8_t* prev = heap;
+
+    if (heap + incr > __StackLimit) {
+        errno = ENOMEM;
+        return (void*)-1;
+    }
+    heap += incr;
+    return prev;
+}
@@ -0,0 +1,444 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include <math.h>
+#include <stdarg.h>
+#include <vector>
+
+#include "mbed.h"
+#include "MMA8451Q.h"
+#include "TSISensor.h"
+#include "SLCD.h"
+#include "Sim.h"
+
+#define ACC_ADDRESS  (0x1d<<1)
+#define MAG_ADDRESS  (0x0e<<1)
+
+// MMA8451Q registers
+#define ACC_F_STATUS      0x00
+#define ACC_OUT_X_MSB     0x01
+#define ACC_OUT_Z_LSB     0x06
+#define ACC_F_SETUP       0x09
+#define ACC_INT_SOURCE    0x0C
+#define ACC_WHO_AM_I      0x0D
+#define ACC_FF_MT_SRC     0x16
+#define ACC_TRANSIENT_SRC 0x1E
+#define ACC_PULSE_SRC     0x22
+#define ACC_CTRL_REG1     0x2A
+#define ACC_FIFO_DEPTH    32
+
+// MAG3110 registers
+#define MAG_OUT_X_MSB     0x01
+#define MAG_WHO_AM_I      0x07
+
+// Board lying still, tilted a little and rocking once a second
+static void defaultAccTrace(uint64_t us, int16_t xyz[3]) {
+    double phase = 2 * M_PI * (us % 1000000) / 1000000.0;
+    xyz[0] = (int16_t)(300 * sin(phase));
+    xyz[1] = (int16_t)(150 * cos(phase));
+    xyz[2] = 4050;
+}
+
+static void defaultMagTrace(uint64_t us, int16_t xyz[3]) {
+    xyz[0] = 120;
+    xyz[1] = -340;
+    xyz[2] = 610;
+}
+
+static SimTrace accTrace = defaultAccTrace;
+static SimTrace magTrace = defaultMagTrace;
+static bool magPresent = true;
+static uint8_t touch = 0;
+static uint16_t light = 0;
+static char lcdText[16] = "";
+
+struct TraceRow {
+    uint64_t us;
+    int16_t xyz[3];
+};
+
+static std::vector<TraceRow> traceRows;
+static uint64_t traceStart;
+
+static void recordedAccTrace(uint64_t us, int16_t xyz[3]) {
+    size_t lo = 0, hi = traceRows.size();
+
+    us = us > traceStart ? us - traceStart : 0;
+    // Last row at or before us
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (traceRows[mid].us <= us)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    memcpy(xyz, traceRows[lo].xyz, sizeof(traceRows[lo].xyz));
+}
+
+void simSetAccTrace(SimTrace trace) {
+    accTrace = trace ? trace : defaultAccTrace;
+}
+
+bool simLoadAccTrace(const char* path) {
+    FILE* f = fopen(path, "r");
+    char line[128];
+
+    if (!f)
+        return false;
+    traceRows.clear();
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long us;
+        int x, y, z;
+        if (sscanf(line, "%llu,%d,%d,%d", &us, &x, &y, &z) != 4)
+            continue;  // Header or comment
+        TraceRow row = {us, {(int16_t)x, (int16_t)y, (int16_t)z}};
+        traceRows.push_back(row);
+    }
+    fclose(f);
+    if (traceRows.empty())
+        return false;
+    traceStart = simTime();
+    accTrace = recordedAccTrace;
+    return true;
+}
+
+void simSetMagTrace(SimTrace trace) {
+    magTrace = trace ? trace : defaultMagTrace;
+}
+
+void simSetMagPresent(bool present) {
+    magPresent = present;
+}
+
+void simSetTouch(uint8_t distance) {
+    touch = distance;
+}
+
+uint8_t simTouch() {
+    return touch;
+}
+
+void simSetLight(uint16_t value) {
+    light = value;
+}
+
+uint16_t simLight() {
+    return light;
+}
+
+void simSetLcdText(const char* text) {
+    snprintf(lcdText, sizeof(lcdText), "%s", text);
+}
+
+const char* simLcdText() {
+    return lcdText;
+}
+
+// Interrupt pins
+
+typedef std::vector<std::pair<void*, int> > InterruptIns;
+
+// Built on first use: the firmware's global InterruptIns register from
+// their constructors, before this file's statics may be initialised
+static InterruptIns& interruptIns() {
+    static InterruptIns ins;
+    return ins;
+}
+
+void simAddInterruptIn(void* in, int pin) {
+    interruptIns().push_back(std::make_pair(in, pin));
+}
+
+void simRemoveInterruptIn(void* in) {
+    InterruptIns& ins = interruptIns();
+    for (size_t i=0; i<ins.size(); i++) {
+        if (ins[i].first == in) {
+            ins.erase(ins.begin() + i);
+            return;
+        }
+    }
+}
+
+static void accIntFall(void*) {
+    InterruptIns& ins = interruptIns();
+    for (size_t i=0; i<ins.size(); i++) {
+        if (ins[i].second == PTA14 || ins[i].second == PTC5)
+            InterruptIn::irq((InterruptIn*)ins[i].first, false);
+    }
+}
+
+// MMA8451Q: register file, output data rate and the 32 sample FIFO in
+// fill mode, filled lazily from the trace whenever the bus touches it
+
+static uint8_t accRegs[256];
+static uint8_t accPointer;
+static bool accInit = false;
+static uint64_t accActiveSince;
+static uint64_t accProduced;      // Samples since accActiveSince
+static int16_t accFifo[ACC_FIFO_DEPTH][3];
+static int accFifoCount;
+static bool accFifoOverflow;
+static uint8_t accOut[6];         // Sample being read out
+static int accOutIndex;
+static bool accNewRead;           // Register pointer just set
+
+static uint32_t accPeriodUs() {
+    static const uint32_t periods[8] = {1250, 2500, 5000, 10000, 20000, 80000, 160000, 640000};
+    return periods[(accRegs[ACC_CTRL_REG1] >> 3) & 7];
+}
+
+static bool accActive() {
+    return accRegs[ACC_CTRL_REG1] & 1;
+}
+
+static bool accFifoMode() {
+    return (accRegs[ACC_F_SETUP] >> 6) != 0;
+}
+
+static void accReset() {
+    memset(accRegs, 0, sizeof(accRegs));
+    accRegs[ACC_WHO_AM_I] = 0x1A;
+    accInit = true;
+}
+
+static void accUpdateFifo() {
+    if (!accActive() || !accFifoMode())
+        return;
+    uint32_t period = accPeriodUs();
+    uint64_t due = (simTime() - accActiveSince) / period;
+    if (due > accProduced + ACC_FIFO_DEPTH + 1)
+        accProduced = due - ACC_FIFO_DEPTH - 1;  // The rest would overflow anyway
+    while (accProduced < due) {
+        accProduced++;
+        if (accFifoCount == ACC_FIFO_DEPTH) {
+            accFifoOverflow = true;
+            continue;
+        }
+        accTrace(accActiveSince + accProduced * period, accFifo[accFifoCount++]);
+    }
+}
+
+static void accLoadOut(const int16_t xyz[3]) {
+    for (int i=0; i<3; i++) {
+        uint16_t v = (uint16_t)(xyz[i] << 2);
+        accOut[2*i] = v >> 8;
+        accOut[2*i + 1] = v & 0xff;
+    }
+}
+
+static uint8_t accReadByte() {
+    uint8_t reg = accPointer;
+
+    if (reg >= ACC_OUT_X_MSB && reg <= ACC_OUT_Z_LSB) {
+        if (accNewRead || (reg == ACC_OUT_X_MSB && accFifoMode())) {
+            int16_t xyz[3];
+            if (accFifoMode()) {
+                accUpdateFifo();
+                if (accFifoCount) {
+                    memcpy(xyz, accFifo[0], sizeof(xyz));
+                    memmove(accFifo[0], accFifo[1], --accFifoCount * sizeof(accFifo[0]));
+                    accFifoOverflow = false;
+                } else {
+                    memset(xyz, 0, sizeof(xyz));
+                }
+            } else {
+                accTrace(simTime(), xyz);
+            }
+            accLoadOut(xyz);
+            accOutIndex = reg - ACC_OUT_X_MSB;
+            accNewRead = false;
+        }
+        uint8_t v = accOut[accOutIndex++];
+        // The OUT window wraps in FIFO mode, so a burst pops sample after sample
+        accPointer = (reg == ACC_OUT_Z_LSB && accFifoMode()) ? ACC_OUT_X_MSB : reg + 1;
+        return v;
+    }
+
+    accPointer = reg + 1;
+    accNewRead = false;
+    switch (reg) {
+        case ACC_F_STATUS:
+            if (!accFifoMode())
+                return 0x0F;  // New X, Y and Z data
+            accUpdateFifo();
+            return (accFifoOverflow ? 0x80 : 0) |
+                   (accFifoCount >= (accRegs[ACC_F_SETUP] & 0x3F) ? 0x40 : 0) | accFifoCount;
+        case ACC_FF_MT_SRC:
+        case ACC_TRANSIENT_SRC:
+        case ACC_PULSE_SRC:
+            // Reading the event source releases the latched interrupt
+            accRegs[ACC_INT_SOURCE] = 0;
+            return accRegs[reg];
+        default:
+            return accRegs[reg];
+    }
+}
+
+static void accWriteByte(uint8_t value) {
+    uint8_t reg = accPointer++;
+
+    if (reg == ACC_CTRL_REG1) {
+        bool wasActive = accActive();
+        accRegs[reg] = value;
+        if (accActive() && !wasActive) {
+            accActiveSince = simTime();
+            accProduced = 0;
+        }
+        return;
+    }
+    if (reg == ACC_F_SETUP) {
+        accFifoCount = 0;
+        accFifoOverflow = false;
+    }
+    accRegs[reg] = value;
+}
+
+void simAccEvent(uint8_t intSource) {
+    if (!accInit)
+        accReset();
+    accRegs[ACC_INT_SOURCE] |= intSource;
+    simAt(simTime(), accIntFall, 0);
+}
+
+// MAG3110: WHO_AM_I and the outputs from the trace
+
+static uint8_t magRegs[256];
+static uint8_t magPointer;
+static uint8_t magOut[6];
+
+static uint8_t magReadByte() {
+    uint8_t reg = magPointer++;
+
+    if (reg == MAG_OUT_X_MSB) {
+        int16_t xyz[3];
+        magTrace(simTime(), xyz);
+        for (int i=0; i<3; i++) {
+            magOut[2*i] = (uint16_t)xyz[i] >> 8;
+            magOut[2*i + 1] = xyz[i] & 0xff;
+        }
+    }
+    if (reg >= MAG_OUT_X_MSB && reg < MAG_OUT_X_MSB + 6)
+        return magOut[reg - MAG_OUT_X_MSB];
+    if (reg == MAG_WHO_AM_I)
+        return 0xC4;
+    return magRegs[reg];
+}
+
+// I2C bus, returns 0 on ACK like mbed
+
+int simI2CWrite(int address, const char* data, int length) {
+    if (!accInit)
+        accReset();
+    if (address == ACC_ADDRESS) {
+        if (length < 1)
+            return 0;
+        accPointer = data[0];
+        accNewRead = true;
+        for (int i=1; i<length; i++)
+            accWriteByte(data[i]);
+        return 0;
+    }
+    if (address == MAG_ADDRESS && magPresent) {
+        if (length < 1)
+            return 0;
+        magPointer = data[0];
+        for (int i=1; i<length; i++)
+            magRegs[magPointer++] = data[i];
+        return 0;
+    }
+    return 1;
+}
+
+int simI2CRead(int address, char* data, int length) {
+    if (!accInit)
+        accReset();
+    if (address == ACC_ADDRESS) {
+        for (int i=0; i<length; i++)
+            data[i] = accReadByte();
+        return 0;
+    }
+    if (address == MAG_ADDRESS && magPresent) {
+        for (int i=0; i<length; i++)
+            data[i] = magReadByte();
+        return 0;
+    }
+    return 1;
+}
+
+// Library stand-ins
+
+MMA8451Q::MMA8451Q(PinName sda, PinName scl, int addr) : m_i2c(sda, scl), m_addr(addr) {
+    uint8_t data[2] = {ACC_CTRL_REG1, 0x01};  // Active, 800 Hz
+    writeRegs(data, 2);
+}
+
+uint8_t MMA8451Q::getWhoAmI() {
+    uint8_t who_am_i = 0;
+    readRegs(ACC_WHO_AM_I, &who_am_i, 1);
+    return who_am_i;
+}
+
+float MMA8451Q::getAccX() {
+    return getAccAxis(ACC_OUT_X_MSB) / 4096.0f;
+}
+
+float MMA8451Q::getAccY() {
+    return getAccAxis(ACC_OUT_X_MSB + 2) / 4096.0f;
+}
+
+float MMA8451Q::getAccZ() {
+    return getAccAxis(ACC_OUT_X_MSB + 4) / 4096.0f;
+}
+
+void MMA8451Q::getAccAllAxis(int16_t* res) {
+    uint8_t data[6];
+
+    readRegs(ACC_OUT_X_MSB, data, 6);
+    for (int i=0; i<3; i++)
+        res[i] = (int16_t)((data[2*i] << 8) | data[2*i + 1]) >> 2;
+}
+
+int16_t MMA8451Q::getAccAxis(uint8_t addr) {
+    uint8_t data[2];
+
+    readRegs(addr, data, 2);
+    return (int16_t)((data[0] << 8) | data[1]) >> 2;
+}
+
+void MMA8451Q::readRegs(int addr, uint8_t* data, int len) {
+    char t[1] = {(char)addr};
+    m_i2c.write(m_addr, t, 1, true);
+    m_i2c.read(m_addr, (char*)data, len);
+}
+
+void MMA8451Q::writeRegs(uint8_t* data, int len) {
+    m_i2c.write(m_addr, (char*)data, len);
+}
+
+uint8_t TSISensor::readDistance() {
+    return simTouch();
+}
+
+void SLCD::printf(const char* format, ...) {
+    char text[16];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    simSetLcdText(text);
+}
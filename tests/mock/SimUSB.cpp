@@ -0,0 +1,253 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include <string.h>
+#include <deque>
+
+#include "USBDevice.h"
+#include "Sim.h"
+
+// Host side of the simulated USB bus, one pipe per interface
+struct SimPipe {
+    std::deque<std::string> rx;  // OUT packets not yet read by the firmware
+    std::string received;        // IN data since the last simUsbTake()
+    std::string inflight;        // IN packet on the endpoint
+    uint32_t packets;
+    uint32_t transfers;          // Packets shorter than the maximum, zero-length ones too
+    bool busy;
+    bool scheduled;              // Completion of inflight is pending
+    bool reading;
+};
+
+static SimPipe pipes[2];         // By isCDC
+static USBDevice* device = 0;
+static bool configured = false;
+static uint32_t packetUs = 100;
+
+static SimPipe* inPipe(uint8_t endpoint) {
+    if (endpoint == EPBULK_IN)
+        return &pipes[1];
+    if (endpoint == EP5IN)
+        return &pipes[0];
+    return 0;
+}
+
+static SimPipe* outPipe(uint8_t endpoint) {
+    if (endpoint == EPBULK_OUT)
+        return &pipes[1];
+    if (endpoint == EP5OUT)
+        return &pipes[0];
+    return 0;
+}
+
+// The host has taken the IN packet
+static void inComplete(void* arg) {
+    bool isCDC = (intptr_t)arg != 0;
+    SimPipe& p = pipes[isCDC];
+
+    p.scheduled = false;
+    if (!p.busy)
+        return;
+    p.received += p.inflight;
+    p.packets++;
+    if (p.inflight.size() < MAX_PACKET_SIZE_EPBULK)
+        p.transfers++;
+    p.busy = false;
+    USBHAL* hal = device;
+    if (isCDC)
+        hal->EP2_IN_callback();
+    else
+        hal->EP5_IN_callback();
+}
+
+static void scheduleComplete(bool isCDC) {
+    SimPipe& p = pipes[isCDC];
+
+    if (p.busy && p.reading && !p.scheduled) {
+        p.scheduled = true;
+        simSchedule(simTime() + packetUs, 0, &p, inComplete, (void*)(intptr_t)isCDC);
+    }
+}
+
+// Any host activity is a USB interrupt that wakes the firmware
+static void usbWake(void*) {
+}
+
+static void configure(void*) {
+    configured = true;
+    device->USBCallback_setConfiguration(1);
+}
+
+static void busReset(void*) {
+    configured = false;
+    for (int i=0; i<2; i++) {
+        simCancel(&pipes[i]);
+        pipes[i].rx.clear();
+        pipes[i].busy = false;
+        pipes[i].scheduled = false;
+    }
+    device->USBCallback_busReset();
+}
+
+static void setDtr(void* arg) {
+    intptr_t v = (intptr_t)arg;
+    CONTROL_TRANSFER* transfer = device->getTransferPtr();
+
+    memset(transfer, 0, sizeof(*transfer));
+    transfer->setup.bmRequestType.Type = CLASS_TYPE;
+    transfer->setup.bmRequestType.Recipient = INTERFACE_RECIPIENT;
+    transfer->setup.bRequest = 0x22;         // CDC SET_CONTROL_LINE_STATE
+    transfer->setup.wIndex = (v & 2) ? 1 : 2;  // CDC data or WebUSB interface
+    transfer->setup.wValue = v & 1;          // DTR
+    device->USBCallback_request();
+}
+
+void simUsbConfigure() {
+    simAt(simTime(), configure, 0);
+}
+
+void simUsbReset() {
+    simAt(simTime(), busReset, 0);
+}
+
+void simUsbSetDtr(bool isCDC, bool on) {
+    simAt(simTime(), setDtr, (void*)(intptr_t)((isCDC ? 2 : 0) | (on ? 1 : 0)));
+}
+
+void simUsbSend(bool isCDC, const std::string& data) {
+    for (size_t i=0; i<data.size(); i+=MAX_PACKET_SIZE_EPBULK)
+        pipes[isCDC].rx.push_back(data.substr(i, MAX_PACKET_SIZE_EPBULK));
+    simAt(simTime(), usbWake, 0);
+}
+
+void simUsbSetReading(bool isCDC, bool reading) {
+    pipes[isCDC].reading = reading;
+    scheduleComplete(isCDC);
+}
+
+void simUsbSetPacketTime(uint32_t us) {
+    packetUs = us;
+}
+
+std::string simUsbTake(bool isCDC) {
+    std::string s;
+
+    s.swap(pipes[isCDC].received);
+    return s;
+}
+
+bool simRunUntilReceived(bool isCDC, const char* needle, uint32_t timeoutUs) {
+    const std::string& received = pipes[isCDC].received;
+    uint64_t end = simTime() + timeoutUs;
+    size_t len = strlen(needle);
+    size_t from = 0;
+
+    while (received.find(needle, from) == std::string::npos) {
+        if (simTime() >= end)
+            return false;
+        // Only the tail can still complete a match
+        from = received.size() >= len ? received.size() - len + 1 : 0;
+        simRun(SIM_RECEIVE_STEP_US);
+    }
+    return true;
+}
+
+uint32_t simUsbPackets(bool isCDC) {
+    return pipes[isCDC].packets;
+}
+
+uint32_t simUsbTransfers(bool isCDC) {
+    return pipes[isCDC].transfers;
+}
+
+void simUsbAttach(USBDevice* d) {
+    device = d;
+    pipes[0].reading = true;
+    pipes[1].reading = true;
+}
+
+bool simUsbConfigured() {
+    return configured;
+}
+
+uint32_t simUsbEndpointWrite(uint8_t endpoint, const uint8_t* data, uint32_t size) {
+    SimPipe* p = inPipe(endpoint);
+
+    if (!p)
+        return EP_COMPLETED;  // Interrupt endpoint, nothing listens
+    if (!configured || p->busy)
+        return EP_INVALID;
+    p->inflight.assign((const char*)data, size);
+    p->busy = true;
+    scheduleComplete(p == &pipes[1]);
+    return EP_PENDING;
+}
+
+bool simUsbRead(uint8_t endpoint, uint8_t* buffer, uint32_t* size, uint32_t maxSize) {
+    SimPipe* p = outPipe(endpoint);
+
+    simLoopStep(SIM_LOOP_US);
+    if (!p || !configured || p->rx.empty())
+        return false;
+    std::string packet = p->rx.front();
+    p->rx.pop_front();
+    *size = packet.size() < maxSize ? packet.size() : maxSize;
+    memcpy(buffer, packet.data(), *size);
+    return true;
+}
+
+// USB controller and device stand-ins
+
+EP_STATUS USBHAL::endpointWrite(uint8_t endpoint, uint8_t* data, uint32_t size) {
+    return (EP_STATUS)simUsbEndpointWrite(endpoint, data, size);
+}
+
+EP_STATUS USBHAL::endpointWriteResult(uint8_t endpoint) {
+    return EP_COMPLETED;
+}
+
+USBDevice::USBDevice(uint16_t vendor_id, uint16_t product_id, uint16_t product_release) {
+    memset(&m_transfer, 0, sizeof(m_transfer));
+    simUsbAttach(this);
+}
+
+bool USBDevice::configured() {
+    return simUsbConfigured();
+}
+
+void USBDevice::connect(bool blocking) {
+}
+
+void USBDevice::disconnect() {
+}
+
+bool USBDevice::readStart(uint8_t endpoint, uint32_t maxSize) {
+    return true;
+}
+
+bool USBDevice::readEP(uint8_t endpoint, uint8_t* buffer, uint32_t* size, uint32_t maxSize) {
+    while (!simUsbRead(endpoint, buffer, size, maxSize)) {
+        if (!configured())
+            return false;
+        simSleep();
+    }
+    return true;
+}
+
+bool USBDevice::readEP_NB(uint8_t endpoint, uint8_t* buffer, uint32_t* size, uint32_t maxSize) {
+    return simUsbRead(endpoint, buffer, size, maxSize);
+}
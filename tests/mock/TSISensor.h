@@ -0,0 +1,31 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef TSISENSOR_H
+#define TSISENSOR_H
+
+#include "mbed.h"
+
+// Host stand-in for the touch slider, reads the simulated finger position
+class TSISensor {
+public:
+    TSISensor() {}
+    uint8_t readDistance();
+    float readPercentage() { return readDistance() / 40.0f; }
+};
+
+#endif
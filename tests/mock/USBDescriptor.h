@@ -0,0 +1,59 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef USBDESCRIPTOR_H
+#define USBDESCRIPTOR_H
+
+#define DEVICE_DESCRIPTOR        1
+#define CONFIGURATION_DESCRIPTOR 2
+#define STRING_DESCRIPTOR        3
+#define INTERFACE_DESCRIPTOR     4
+#define ENDPOINT_DESCRIPTOR      5
+
+#define CONFIGURATION_DESCRIPTOR_LENGTH 9
+#define INTERFACE_DESCRIPTOR_LENGTH     9
+#define ENDPOINT_DESCRIPTOR_LENGTH      7
+
+#define LSB(n) ((n) & 0xff)
+#define MSB(n) (((n) & 0xff00) >> 8)
+
+#define C_RESERVED (1U << 7)
+#define C_POWER(mA) (((mA) + 1) / 2)
+
+#define PHY_TO_DESC(endpoint) (((endpoint) >> 1) | (((endpoint) & 1) ? 0x80 : 0))
+
+#define E_CONTROL     0x00
+#define E_ISOCHRONOUS 0x01
+#define E_BULK        0x02
+#define E_INTERRUPT   0x03
+
+// WebUSB
+#define WEBUSB_URL              3
+#define WEBUSB_URL_SCHEME_HTTP  0
+#define WEBUSB_URL_SCHEME_HTTPS 1
+
+#define WEBUSB_DESCRIPTOR_SET_HEADER       0
+#define WEBUSB_CONFIGURATION_SUBSET_HEADER 1
+#define WEBUSB_FUNCTION_SUBSET_HEADER      2
+
+#define WEBUSB_DESCRIPTOR_SET_LENGTH       5
+#define WEBUSB_CONFIGURATION_SUBSET_LENGTH 4
+#define WEBUSB_FUNCTION_SUBSET_LENGTH      3
+
+#define URL_OFFSET_ALLOWED_ORIGIN 2
+
+#endif
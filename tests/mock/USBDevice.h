@@ -0,0 +1,81 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef USBDEVICE_H
+#define USBDEVICE_H
+
+#include "USBHAL.h"
+
+#define STANDARD_TYPE 0
+#define CLASS_TYPE    1
+#define VENDOR_TYPE   2
+
+#define DEVICE_RECIPIENT    0
+#define INTERFACE_RECIPIENT 1
+
+#define HOST_TO_DEVICE 0
+#define DEVICE_TO_HOST 1
+
+struct SETUP_PACKET {
+    struct {
+        uint8_t dataTransferDirection;
+        uint8_t Type;
+        uint8_t Recipient;
+    } bmRequestType;
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+};
+
+struct CONTROL_TRANSFER {
+    SETUP_PACKET setup;
+    uint8_t* ptr;
+    uint32_t remaining;
+    uint8_t direction;
+    bool zlp;
+    bool notify;
+};
+
+class USBDevice : public USBHAL {
+public:
+    USBDevice(uint16_t vendor_id, uint16_t product_id, uint16_t product_release);
+
+    bool configured();
+    void connect(bool blocking=true);
+    void disconnect();
+
+    bool readStart(uint8_t endpoint, uint32_t maxSize);
+    bool readEP(uint8_t endpoint, uint8_t* buffer, uint32_t* size, uint32_t maxSize);
+    bool readEP_NB(uint8_t endpoint, uint8_t* buffer, uint32_t* size, uint32_t maxSize);
+    bool addEndpoint(uint8_t endpoint, uint32_t maxPacket) { return true; }
+    CONTROL_TRANSFER* getTransferPtr() { return &m_transfer; }
+
+    virtual bool USBCallback_request() { return false; }
+    virtual bool USBCallback_setConfiguration(uint8_t configuration) { return false; }
+    virtual void USBCallback_busReset() {}
+    virtual uint8_t* stringIproductDesc() { return 0; }
+    virtual uint8_t* stringIinterfaceDesc() { return 0; }
+    virtual uint8_t* configurationDesc() { return 0; }
+    virtual uint8_t* stringImanufacturerDesc() { return 0; }
+    virtual uint8_t* stringIserialDesc() { return 0; }
+
+private:
+    CONTROL_TRANSFER m_transfer;
+};
+
+#endif
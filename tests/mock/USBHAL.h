@@ -0,0 +1,61 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef USBHAL_H
+#define USBHAL_H
+
+#include "mbed.h"
+
+// KL25Z/KL46Z physical endpoint numbers
+#define EP0OUT 0
+#define EP0IN  1
+#define EP1OUT 2
+#define EP1IN  3
+#define EP2OUT 4
+#define EP2IN  5
+#define EP3OUT 6
+#define EP3IN  7
+#define EP4OUT 8
+#define EP4IN  9
+#define EP5OUT 10
+#define EP5IN  11
+
+#define EPINT_IN   EP1IN
+#define EPBULK_IN  EP2IN
+#define EPBULK_OUT EP2OUT
+
+#define MAX_PACKET_SIZE_EP0    64
+#define MAX_PACKET_SIZE_EPINT  64
+#define MAX_PACKET_SIZE_EPBULK 64
+
+enum EP_STATUS { EP_COMPLETED, EP_PENDING, EP_INVALID, EP_STALLED };
+
+// Host stand-in for the USB controller. The simulated host, see Sim.h,
+// takes written packets off the IN endpoints and completes them.
+class USBHAL {
+public:
+    virtual ~USBHAL() {}
+
+    EP_STATUS endpointWrite(uint8_t endpoint, uint8_t* data, uint32_t size);
+    EP_STATUS endpointWriteResult(uint8_t endpoint);
+
+    virtual bool EP1_IN_callback() { return false; }
+    virtual bool EP2_IN_callback() { return false; }
+    virtual bool EP5_IN_callback() { return false; }
+};
+
+#endif
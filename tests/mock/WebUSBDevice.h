@@ -0,0 +1,37 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef WEBUSBDEVICE_H
+#define WEBUSBDEVICE_H
+
+#include "USBDevice.h"
+#include "USBDescriptor.h"
+
+#define WINUSB_VENDOR_CODE 0x02
+
+class WebUSBDevice : public USBDevice {
+public:
+    WebUSBDevice(uint16_t vendor_id, uint16_t product_id, uint16_t product_release)
+        : USBDevice(vendor_id, product_id, product_release) {}
+
+    virtual bool USBCallback_request() { return false; }
+    virtual uint8_t* allowedOriginsDesc() = 0;
+    virtual uint8_t* urlIlandingPage() = 0;
+    virtual uint8_t* urlIallowedOrigin() = 0;
+};
+
+#endif
@@ -0,0 +1,203 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#ifndef MBED_H
+#define MBED_H
+
+// Host stand-in for the parts of the mbed 2 HAL the firmware uses. Time,
+// interrupts and the peripherals are simulated by Sim.cpp, see Sim.h.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "us_ticker_api.h"
+
+typedef int PinName;
+
+enum {
+    PTA14 = 14, PTC5 = 69, PTE22 = 150, PTE24 = 152, PTE25 = 153,
+    LED_RED = 200, LED_GREEN, LED_BLUE,
+    USBTX = 300, USBRX,
+    NC = -1
+};
+
+enum PinMode { PullUp, PullDown, PullNone };
+
+class Timer {
+public:
+    Timer();
+    void start();
+    void stop();
+    void reset();
+    int read_us();
+    int read_ms();
+    float read();
+
+private:
+    uint64_t m_start;
+    uint64_t m_elapsed;
+    bool m_running;
+};
+
+class Ticker {
+public:
+    Ticker() : m_fptr(0), m_period(0) {}
+    virtual ~Ticker() { detach(); }
+    void attach_us(void (*fptr)(void), uint32_t us);
+    void attach(void (*fptr)(void), float seconds) { attach_us(fptr, (uint32_t)(seconds * 1000000.0f)); }
+    void detach();
+
+    // Called by the simulator when the period is up
+    static void irq(Ticker* ticker);
+
+private:
+    void (*m_fptr)(void);
+    uint32_t m_period;
+};
+
+class TimerEvent {
+public:
+    TimerEvent() {}
+    virtual ~TimerEvent() { remove(); }
+
+    // Called by the simulator at the inserted timestamp
+    static void irq(TimerEvent* event) { event->handler(); }
+
+protected:
+    virtual void handler() = 0;
+    void insert(timestamp_t timestamp);
+    void remove();
+};
+
+class InterruptIn {
+public:
+    InterruptIn(PinName pin);
+    ~InterruptIn();
+    void rise(void (*fptr)(void)) { m_rise = fptr; }
+    void fall(void (*fptr)(void)) { m_fall = fptr; }
+    void mode(PinMode) {}
+    void enable_irq() { m_enabled = true; }
+    void disable_irq() { m_enabled = false; }
+
+    // Called by the simulator on an edge of the pin
+    static void irq(InterruptIn* in, bool rising);
+
+    PinName pin() const { return m_pin; }
+
+private:
+    PinName m_pin;
+    void (*m_rise)(void);
+    void (*m_fall)(void);
+    bool m_enabled;
+};
+
+class PwmOut {
+public:
+    PwmOut(PinName pin);
+    void period(float seconds) { m_period = seconds; }
+    void write(float value) { m_value = value; }
+    float read() { return m_value; }
+    PwmOut& operator=(float value) { write(value); return *this; }
+    operator float() { return read(); }
+
+private:
+    float m_period;
+    float m_value;
+};
+
+class DigitalOut {
+public:
+    DigitalOut(PinName) : m_value(0) {}
+    void write(int value) { m_value = value; }
+    int read() { return m_value; }
+    DigitalOut& operator=(int value) { write(value); return *this; }
+    operator int() { return read(); }
+
+private:
+    int m_value;
+};
+
+class AnalogIn {
+public:
+    AnalogIn(PinName pin) : m_pin(pin) {}
+    uint16_t read_u16();
+    float read() { return read_u16() / 65535.0f; }
+
+private:
+    PinName m_pin;
+};
+
+// Transfers go to the simulated devices on the bus, by address
+class I2C {
+public:
+    I2C(PinName sda, PinName scl) : m_freq(100000) {}
+    void frequency(int hz) { m_freq = hz; }
+    int write(int address, const char* data, int length, bool repeated=false);
+    int read(int address, char* data, int length, bool repeated=false);
+
+private:
+    int m_freq;
+};
+
+void sleep(void);
+void deepsleep(void);
+void wait_us(int us);
+inline void wait_ms(int ms) { wait_us(ms * 1000); }
+inline void wait(float s) { wait_us((int)(s * 1000000.0f)); }
+
+// Fatal error: prints the message and ends the test program
+extern "C" void error(const char* format, ...);
+
+void __disable_irq(void);
+void __enable_irq(void);
+inline void __DMB(void) { __sync_synchronize(); }
+
+// SysTick counts down at SystemCoreClock. On the host it follows the
+// host's own clock, so cycle counts measure the firmware code as built
+// for the host, scaled to the target clock.
+class SysTickVal {
+public:
+    operator uint32_t() const;
+    SysTickVal& operator=(uint32_t value);
+};
+
+struct SysTick_Type {
+    uint32_t CTRL;
+    uint32_t LOAD;
+    SysTickVal VAL;
+    uint32_t CALIB;
+};
+
+extern SysTick_Type* SysTick;
+
+// System integration module, only the unique id
+struct SIM_Type {
+    uint32_t UIDMH;
+    uint32_t UIDML;
+    uint32_t UIDL;
+};
+
+extern SIM_Type simSIM;
+#define SIM (&simSIM)
+extern uint32_t SystemCoreClock;
+
+#define SysTick_CTRL_CLKSOURCE_Msk (1 << 2)
+#define SysTick_CTRL_ENABLE_Msk    (1 << 0)
+
+#endif
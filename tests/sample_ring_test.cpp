@@ -0,0 +1,175 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+// SampleRing: order, overrun and reader attach rules, then a real
+// producer and consumer on two threads
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "SampleRing.h"
+#include "Check.h"
+
+struct Item {
+    uint32_t seq;
+    uint32_t check;  // ~seq, catches torn slots
+};
+
+static Item item(uint32_t seq) {
+    Item i = {seq, ~seq};
+    return i;
+}
+
+static void testOrderAndOverrun() {
+    SampleRing<Item, 8> ring;
+    Item out = {0, 0};
+    uint32_t next = 0, expected = 0;
+
+    ring.attach(0);
+    // Bursts of pushes and pops of every size, across many wraps
+    for (int round=0; round<1000; round++) {
+        int pushes = round % 11, pops = (round * 7) % 10;
+        for (int i=0; i<pushes; i++) {
+            bool room = ring.count() < 8;
+            CHECK_EQ(ring.push(item(next)), room);
+            if (room)
+                next++;
+        }
+        for (int i=0; i<pops && ring.pop(&out); i++) {
+            CHECK_EQ(out.seq, expected);
+            expected++;
+        }
+        CHECK_EQ(ring.count(), next - expected);
+    }
+    CHECK(ring.overrunCount() > 0);
+}
+
+static void testReaders() {
+    SampleRing<Item, 4, 2> ring;
+    Item out = {0, 0};
+
+    // Nobody attached: nothing is held back, nothing overruns
+    for (uint32_t i=0; i<10; i++)
+        CHECK(ring.push(item(i)));
+    CHECK_EQ(ring.overrunCount(), 0);
+
+    // An attached reader starts at the newest item
+    ring.attach(0);
+    CHECK_EQ(ring.count(0), 0);
+    ring.push(item(10));
+    ring.attach(1);
+    ring.push(item(11));
+    CHECK_EQ(ring.count(0), 2);
+    CHECK_EQ(ring.count(1), 1);
+
+    // The slowest reader sets the room left
+    CHECK(ring.pop(&out, 0));
+    CHECK_EQ(out.seq, 10);
+    CHECK(ring.pop(&out, 0));
+    CHECK(ring.push(item(12)));
+    CHECK(ring.push(item(13)));
+    CHECK(ring.push(item(14)));
+    CHECK(!ring.push(item(15)));  // Reader 1 still has 11..14
+    CHECK_EQ(ring.overrunCount(), 1);
+
+    // A detached reader frees its slots at once
+    ring.detach(1);
+    CHECK(ring.push(item(15)));
+    for (uint32_t seq=12; seq<=15; seq++) {
+        CHECK(ring.pop(&out, 0));
+        CHECK_EQ(out.seq, seq);
+    }
+    CHECK(!ring.pop(&out, 0));
+
+    // Peek and advance see the same item as pop
+    ring.push(item(16));
+    const Item* p = ring.peek(0);
+    CHECK(p && p->seq == 16);
+    ring.advance(0);
+    CHECK(!ring.peek(0));
+}
+
+// Threads standing in for the sampler ISR and the main loop, the
+// producer retrying until there is room so every item goes through.
+// Relies on the host keeping stores in order, like the single core
+// target does.
+#define STRESS_ITEMS 1000000
+
+static SampleRing<Item, 64, 2> stressRing;
+static volatile bool producerDone = false;
+
+static void* producer(void*) {
+    for (uint32_t seq=0; seq<STRESS_ITEMS; seq++) {
+        while (!stressRing.push(item(seq)))
+            sched_yield();
+    }
+    producerDone = true;
+    return 0;
+}
+
+struct Consumer {
+    uint32_t reader;
+    uint32_t popped;
+    uint32_t errors;
+};
+
+static void* consumer(void* arg) {
+    Consumer* c = (Consumer*)arg;
+    Item out = {0, 0};
+    int64_t last = -1;
+
+    for (;;) {
+        bool done = producerDone;
+        if (!stressRing.pop(&out, c->reader)) {
+            if (done)
+                break;
+            sched_yield();
+            continue;
+        }
+        if (out.check != ~out.seq || (int64_t)out.seq != last + 1)
+            c->errors++;
+        last = out.seq;
+        c->popped++;
+    }
+    return 0;
+}
+
+static void testThreads() {
+    pthread_t p, c[2];
+    Consumer consumers[2] = {{0, 0, 0}, {1, 0, 0}};
+
+    stressRing.attach(0);
+    stressRing.attach(1);
+    pthread_create(&c[0], 0, consumer, &consumers[0]);
+    pthread_create(&c[1], 0, consumer, &consumers[1]);
+    pthread_create(&p, 0, producer, 0);
+    pthread_join(p, 0);
+    pthread_join(c[0], 0);
+    pthread_join(c[1], 0);
+
+    CHECK_EQ(consumers[0].errors, 0);
+    CHECK_EQ(consumers[1].errors, 0);
+    CHECK_EQ(consumers[0].popped, STRESS_ITEMS);
+    CHECK_EQ(consumers[1].popped, STRESS_ITEMS);
+}
+
+int main() {
+    testOrderAndOverrun();
+    testReaders();
+    testThreads();
+    return checkResult("sample_ring");
+}
@@ -0,0 +1,135 @@
+/*
+* Copyright 2017 Ingemar Larsson & Lars Gunder Knudsen / empiriKit
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+// StreamFrame encode/decode round trip, for every sensor mask
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "StreamFrame.h"
+#include "Check.h"
+
+static void randomFrame(StreamFrame* f, uint8_t mask) {
+    memset(f, 0, sizeof(*f));
+    f->mask = mask;
+    f->seq = rand();
+    f->timestamp = ((uint32_t)rand() << 16) ^ rand();
+    if (mask & STREAM_FRAME_TOUCH)
+        f->touch = rand() % 41;
+    for (int i=0; i<3; i++) {
+        if (mask & STREAM_FRAME_ACC)
+            f->acc[i] = (int16_t)rand();
+        if (mask & STREAM_FRAME_MAG)
+            f->mag[i] = (int16_t)rand();
+    }
+    if (mask & STREAM_FRAME_LIGHT)
+        f->light = rand();
+}
+
+static bool sameFrame(const StreamFrame& a, const StreamFrame& b) {
+    return a.mask == b.mask && a.seq == b.seq && a.timestamp == b.timestamp &&
+           a.touch == b.touch && a.light == b.light &&
+           !memcmp(a.acc, b.acc, sizeof(a.acc)) && !memcmp(a.mag, b.mag, sizeof(a.mag));
+}
+
+static void testRoundTrip() {
+    for (int mask=0; mask<256; mask++) {
+        for (int n=0; n<100; n++) {
+            StreamFrame in, out;
+            uint8_t buf[STREAM_FRAME_MAX_SIZE + 1];
+            randomFrame(&in, mask);
+            buf[STREAM_FRAME_MAX_SIZE] = 0xAA;
+            uint32_t size = encodeStreamFrame(&in, buf);
+            CHECK_EQ(size, streamFrameSize(mask));
+            CHECK(size <= STREAM_FRAME_MAX_SIZE);
+            CHECK_EQ(buf[STREAM_FRAME_MAX_SIZE], 0xAA);
+            CHECK_EQ(decodeStreamFrame(buf, size, &out), size);
+            CHECK(sameFrame(in, out));
+        }
+    }
+}
+
+// Wire format fixed by the protocol, little-endian
+static void testLayout() {
+    StreamFrame f;
+    uint8_t buf[STREAM_FRAME_MAX_SIZE];
+    static const uint8_t expected[] = {
+        0xE5, 0x0B, 0x34, 0x12, 0x78, 0x56, 0x34, 0x12,
+        0x19, 0x00,                          // touch 25
+        0xFF, 0xFF, 0x00, 0x80, 0x00, 0x10,  // acc -1, -32768, 4096
+        0xE8, 0x03                           // light 1000
+    };
+
+    memset(&f, 0, sizeof(f));
+    f.mask = STREAM_FRAME_TOUCH | STREAM_FRAME_ACC | STREAM_FRAME_LIGHT;
+    f.seq = 0x1234;
+    f.timestamp = 0x12345678;
+    f.touch = 25;
+    f.acc[0] = -1;
+    f.acc[1] = -32768;
+    f.acc[2] = 4096;
+    f.light = 1000;
+    CHECK_EQ(encodeStreamFrame(&f, buf), sizeof(expected));
+    CHECK(!memcmp(buf, expected, sizeof(expected)));
+}
+
+// A host walking a byte stream: partial frames and noise are refused
+static void testDecodeErrors() {
+    StreamFrame f, out;
+    uint8_t buf[STREAM_FRAME_MAX_SIZE];
+
+    randomFrame(&f, STREAM_FRAME_ACC | STREAM_FRAME_MAG);
+    uint32_t size = encodeStreamFrame(&f, buf);
+    for (uint32_t len=0; len<size; len++)
+        CHECK_EQ(decodeStreamFrame(buf, len, &out), 0);
+    buf[0] = 0;
+    CHECK_EQ(decodeStreamFrame(buf, size, &out), 0);
+}
+
+// Frames back to back, as in a USB packet
+static void testStream() {
+    uint8_t stream[64 * STREAM_FRAME_MAX_SIZE];
+    StreamFrame frames[64];
+    uint32_t len = 0;
+
+    for (int i=0; i<64; i++) {
+        randomFrame(&frames[i], rand() & 0x8F);
+        len += encodeStreamFrame(&frames[i], stream + len);
+    }
+    uint32_t pos = 0;
+    int n = 0;
+    while (pos < len) {
+        StreamFrame out;
+        uint32_t used = decodeStreamFrame(stream + pos, len - pos, &out);
+        CHECK(used > 0);
+        if (!used)
+            break;
+        CHECK(sameFrame(frames[n], out));
+        pos += used;
+        n++;
+    }
+    CHECK_EQ(n, 64);
+}
+
+int main() {
+    srand(1);
+    testRoundTrip();
+    testLayout();
+    testDecodeErrors();
+    testStream();
+    return checkResult("stream_frame");
+}